@@ -9,6 +9,7 @@ defmodule ExPassword.Bcrypt do
   use ExPassword.Algorithm
 
   alias ExPassword.Bcrypt.Base
+  alias ExPassword.Bcrypt.Coalescer
 
   @default_salt_length 16
 
@@ -26,7 +27,7 @@ defmodule ExPassword.Bcrypt do
 
   @doc """
   Computes the hash for *password*. A salt of #{@default_salt_length} bytes is randomly generated
-  and prepended to *password* before hashing.
+  (by the CSPRNG of the system, directly in the NIF) and prepended to *password* before hashing.
 
   Valid options are:
 
@@ -40,32 +41,196 @@ defmodule ExPassword.Bcrypt do
   def hash(password, options = %{cost: cost})
     when is_valid_cost(cost) # and map_size(options) == 1
   do
-    salt =
-      @default_salt_length
-      |> :crypto.strong_rand_bytes()
-      |> Base.generate_salt_nif(options)
-    Base.hash_nif(password, salt)
+    Base.hash_password_nif(password, options)
   end
 
   def hash(_password, options) do
     raise_invalid_options(options)
   end
 
+  @doc """
+  Computes the hashes of a list of passwords at once and returns them in the same order. A salt of
+  #{@default_salt_length} bytes is generated for each password by the CSPRNG of the system, directly
+  in the NIF.
+
+  The hashes are computed in a single call to the NIF, as batches processed by the selected kernel
+  (see `kernel_info/0`). Valid options are the same as for `hash/2`.
+
+  An `ArgumentError` will be raised if one of the options is invalid, if one of the elements is not
+  a binary or if an internal error occurs.
+  """
+  def hash_many(passwords, options = %{cost: cost})
+    when is_list(passwords) and is_valid_cost(cost)
+  do
+    Base.hash_many_nif(passwords, options)
+  end
+
+  def hash_many(_passwords, options) do
+    raise_invalid_options(options)
+  end
+
   @doc ~S"""
   Checks that a password matches the given bcrypt hash
 
+  When `ExPassword.Bcrypt.Coalescer` is enabled, concurrent calls are transparently computed together
+  as batches. Otherwise, identical concurrent calls are computed only once (see `single_flight/0`).
+
+  *hash* can also be a handle returned by `parse_hash/1`, in which case it is neither validated nor
+  decoded again.
+
   An `ArgumentError` will be raised if the hash is somehow invalid or if an internal error occurs.
   """
   @impl ExPassword.Algorithm
+  def verify?(password, parsed)
+    when is_reference(parsed)
+  do
+    Base.verify_parsed_nif(password, parsed)
+  end
+
   def verify?(password, hash) do
-    Base.verify_nif(password, hash)
+    if is_binary(password) and Coalescer.running?() and Base.valid_nif(hash) do
+      Coalescer.verify?(password, hash)
+    else
+      Base.verify(password, hash)
+    end
+  end
+
+  @doc ~S"""
+  Validates and decodes *hash* once and returns `{:ok, handle}`, where handle is an opaque reference
+  to its minor version, cost, raw salt and raw digest, or `{:error, :invalid}` if *hash* is not a
+  valid bcrypt hash.
+
+  The handle can be given to `verify?/2`, `get_options/1` and `needs_rehash?/2` in place of *hash*:
+  the verification then compares the raw bytes of the digest without any base64 decoding nor
+  encoding. It is intended for hashes verified repeatedly, the handles can be cached (in ETS for
+  example) as long as the hash they come from does not change.
+
+      iex> {:ok, handle} = ExPassword.Bcrypt.parse_hash("$2y$04$5LEzpJFJbsVLiAPtunma.eWxP0D4CvNd5fw4cV9wT3cSCO.5oG4iO")
+      iex> ExPassword.Bcrypt.verify?("password", handle)
+      true
+  """
+  def parse_hash(hash) do
+    Base.parse_hash_nif(hash)
+  end
+
+  @doc ~S"""
+  Checks that a password matches the given bcrypt hash and, if it does and the cost of the hash is
+  not the one of *options* (see `needs_rehash?/2`), rehashes the password with these options in the
+  same call to the NIF.
+
+  Returns `:error` if the password does not match, `{:ok, nil}` if it does and the hash is up to
+  date or `{:ok, new_hash}` with the hash to persist.
+
+  An `ArgumentError` will be raised if the hash or one of the options is invalid or if an internal
+  error occurs.
+
+      iex> ExPassword.Bcrypt.verify_and_upgrade("password", "$2y$04$5LEzpJFJbsVLiAPtunma.eWxP0D4CvNd5fw4cV9wT3cSCO.5oG4iO", %{cost: 4})
+      {:ok, nil}
+  """
+  def verify_and_upgrade(password, hash, options = %{cost: cost})
+    when is_valid_cost(cost)
+  do
+    Base.verify_and_upgrade_nif(password, hash, options)
+  end
+
+  def verify_and_upgrade(_password, _hash, options) do
+    raise_invalid_options(options)
+  end
+
+  @doc ~S"""
+  Same as `verify_and_upgrade/3` but the new hash is computed in the background so the result of
+  the verification is returned right away.
+
+  Returns `:error` if the password does not match, `{:ok, nil}` if it does and the hash is up to
+  date, `{:ok, ref}` in which case the calling process will later receive a
+  `{:bcrypt_rehashed, ref, new_hash}` message with the hash to persist or `{:ok, :deferred}` if the
+  hash has to be upgraded but no rehash could be scheduled.
+
+  The rehashes are computed one at a time by a thread of the NIF which, on Linux, only uses the
+  CPU left idle by the rest of the system. At most 32 of them can be pending: beyond that, none is
+  scheduled (`{:ok, :deferred}` is returned) and the hash will be upgraded on a next verification
+  (or right away by calling `verify_and_upgrade/3` instead).
+
+  An `ArgumentError` will be raised if the hash or one of the options is invalid.
+  """
+  def verify_and_upgrade_async(password, hash, options = %{cost: cost})
+    when is_valid_cost(cost)
+  do
+    Base.verify_and_upgrade_async_nif(password, hash, options)
+  end
+
+  def verify_and_upgrade_async(_password, _hash, options) do
+    raise_invalid_options(options)
+  end
+
+  @doc ~S"""
+  Checks a list of `{password, hash}` pairs at once and returns, in the same order, a list of
+  booleans telling if each password matches its bcrypt hash.
+
+  All the hashes are computed in a single call to the NIF: the pairs are grouped by cost so the
+  selected kernel (see `kernel_info/0`) processes as many of them as it has lanes in lockstep.
+  Prefer it to several calls to `verify?/2` when you have many passwords to check at the same time.
+
+  An `ArgumentError` will be raised if one of the elements is not a pair of binaries or if one of
+  the hashes is somehow invalid. All the pairs are checked before any hash is computed.
+
+      iex> ExPassword.Bcrypt.verify_many?([
+      ...>   {"password", "$2y$04$5LEzpJFJbsVLiAPtunma.eWxP0D4CvNd5fw4cV9wT3cSCO.5oG4iO"},
+      ...>   {"", "$2y$04$5LEzpJFJbsVLiAPtunma.eWxP0D4CvNd5fw4cV9wT3cSCO.5oG4iO"},
+      ...> ])
+      [true, false]
+  """
+  def verify_many?(pairs)
+    when is_list(pairs)
+  do
+    Base.verify_many_nif(pairs)
+  end
+
+  @doc ~S"""
+  Checks a password against several bcrypt hashes (typically the history of the previous passwords
+  of a user) and returns the index (0-based) of the first one it matches or `nil` if none.
+
+  All the hashes are computed in a single call to the NIF: the key schedule of the password is
+  computed once and the hashes are processed as batches by the selected kernel (see `kernel_info/0`).
+
+  An `ArgumentError` will be raised if one of the hashes is somehow invalid, even if it comes after
+  a matching one: all the hashes are checked before any is computed.
+
+      iex> ExPassword.Bcrypt.matches_any?("password", [
+      ...>   "$2y$04$35MAXYSjPyfzANk1PE4jpe6BFtSTc3m125J3MsT9LfMAmKsxH.DIu",
+      ...>   "$2y$04$5LEzpJFJbsVLiAPtunma.eWxP0D4CvNd5fw4cV9wT3cSCO.5oG4iO",
+      ...> ])
+      1
+  """
+  def matches_any?(password, hashes)
+    when is_list(hashes)
+  do
+    Base.matches_any_nif(password, hashes)
+  end
+
+  @doc ~S"""
+  Checks several candidates (variants of a same password: caps lock inverted, whitespaces trimmed, ...)
+  against a single bcrypt hash and returns `true` if any of them matches.
+
+  The salt and the cost are decoded once from *hash* and all the candidates are hashed in a single
+  call to the NIF, by the selected kernel (see `kernel_info/0`). Every candidate is hashed and
+  compared in constant time, so the duration does not depend on which one matches.
+
+  An `ArgumentError` will be raised if the hash is somehow invalid or if one of the candidates is
+  not a binary.
+  """
+  def verify_any?(candidates, hash)
+    when is_list(candidates)
+  do
+    Base.verify_any_nif(candidates, hash)
   end
 
   @doc ~S"""
   Extracts informations from a given bcrypt hash (the options used to generate it in the first place)
 
   Returns `{:error, :invalid}` if *hash* is not a valid bcrypt hash else `{:ok, map}` where map is a Map which
-  contains all the parameters that permitted to compute this hash.
+  contains all the parameters that permitted to compute this hash. *hash* can also be a handle returned
+  by `parse_hash/1`.
 
       iex> ExPassword.Bcrypt.get_options("$2a$04$5DCebwootqWMCp59ISrMJ.l4WvgHIVg17ZawDIrDM2IjlE64GDNQS")
       {:ok, %{cost: 4}}
@@ -77,7 +242,8 @@ defmodule ExPassword.Bcrypt do
 
   @doc ~S"""
   Compares the options used to generate *hash* to *options* and returns `true` if they differ, which
-  means you should rehash the password to update its hash.
+  means you should rehash the password to update its hash. *hash* can also be a handle returned by
+  `parse_hash/1`.
   """
   @impl ExPassword.Algorithm
   def needs_rehash?(hash, options = %{cost: cost})
@@ -100,4 +266,117 @@ defmodule ExPassword.Bcrypt do
   def valid?(hash) do
     Base.valid_nif(hash)
   end
+
+  @doc ~S"""
+  Inspects a whole column of hashes at once (typically read from a database for an audit): *hashes*
+  is the concatenation of the bcrypt hashes of 60 bytes each.
+
+  Returns a tuple `{costs, valid, needs_rehash}` where:
+
+    * costs is a binary with, for each hash, a byte giving its cost or 0 if it is invalid
+    * valid is a bitstring with, for each hash, a bit set to 1 if it is a valid bcrypt hash (the same
+      checks as `parse_hash/1`)
+    * needs_rehash is a bitstring with, for each hash, a bit set to 1 if it is valid and its cost is
+      not the one of *options* (see `needs_rehash?/2`)
+
+  The hashes are checked in a single call to the NIF, which yields to the scheduler as needed
+  rather than running on a dirty one. The results are not copied: they are subbinaries of a buffer
+  allocated by the NIF.
+
+  An `ArgumentError` will be raised if the size of *hashes* is not a multiple of 60 or if one of the
+  options is invalid.
+
+      iex> ExPassword.Bcrypt.inspect_many(
+      ...>   "$2y$04$5LEzpJFJbsVLiAPtunma.eWxP0D4CvNd5fw4cV9wT3cSCO.5oG4iO" <>
+      ...>   "$2a$05$CCCCCCCCCCCCCCCCCCCCC.E5YPO9kmyuRGyh0XouQYb4YMJKvyOeW" <>
+      ...>   "25169a6624cdeb2e5d97dd96d0977b2b511453fe3c5f592d0a048baa187a",
+      ...>   %{cost: 4}
+      ...> )
+      {<<4, 5, 0>>, <<1::1, 1::1, 0::1>>, <<0::1, 1::1, 0::1>>}
+  """
+  def inspect_many(hashes, options = %{cost: cost})
+    when is_binary(hashes) and is_valid_cost(cost)
+  do
+    {costs, valid, needs_rehash} = Base.inspect_many_nif(hashes, options)
+    count = byte_size(costs)
+    # the bitmaps are padded to a whole number of bytes
+    <<valid::bitstring-size(count), _padding::bitstring>> = valid
+    <<needs_rehash::bitstring-size(count), _padding::bitstring>> = needs_rehash
+
+    {costs, valid, needs_rehash}
+  end
+
+  def inspect_many(_hashes, options) do
+    raise_invalid_options(options)
+  end
+
+  @doc ~S"""
+  Returns which EksBlowfish kernel (the implementation of the expensive part of bcrypt) was
+  selected for the CPU of this node.
+
+  When the NIF is loaded, the kernels supported by the CPU (the portable ones which compute
+  1, 2 or 4 hashes in lockstep and, when built, the generic SIMD, AVX2 and AVX-512 ones) are benchmarked for
+  a few milliseconds each and the fastest one is retained for the batches of hashes.
+
+  The result is a map with the following keys:
+
+    * kernel: the name of the selected kernel
+    * lanes: the number of hashes the selected kernel computes at once (the best size for the
+      batches of `verify_many?/1` or `hash_many/2`)
+    * backend: the implementation which computes single hashes: `:builtin` (the bundled one,
+      using the kernels above) or `:libxcrypt` when the NIF was built against libxcrypt and its
+      `crypt_rn` was measured faster while giving the same hashes for $2a$, $2b$ and $2y$
+    * kernels: a list of maps describing each kernel built in:
+      - name: its name
+      - lanes: the number of hashes it computes at once
+      - supported: `true` if the CPU supports it
+      - rate: the measured throughput, in iterations of the expensive loop per second (divide it
+        by 2^*cost* to get a number of hashes per second), 0.0 if not supported
+  """
+  def kernel_info do
+    Base.kernel_info_nif()
+  end
+
+  @doc ~S"""
+  Returns how busy the lanes of the selected kernel were kept by the batches (`verify_many?/1`,
+  `hash_many/2`, `matches_any?/2`, `verify_any?/2` and the coalescer) run since the NIF was loaded.
+
+  A lane is refilled with the next hash of the batch as soon as the one it was computing is done,
+  so hashes of different costs do not wait for the costliest one: the lanes stay busy as long as
+  there are pending hashes to feed them and only idle at the end of a batch.
+
+  The result is a map with the following keys:
+
+    * kernel: the name of the selected kernel
+    * lanes: its number of lanes
+    * iterations: the number of iterations of the expensive loop run by the kernel
+    * busy: a list with, for each lane, the fraction (0.0 to 1.0) of these iterations during
+      which it was computing a hash
+  """
+  def utilization do
+    Base.utilization_nif()
+  end
+
+  @doc ~S"""
+  Returns the counters of the single-flight deduplication of `verify?/2`: when the same password
+  is checked against the same hash by several concurrent calls (retries, credential stuffing, ...),
+  it is computed only once and the late callers get the result of the one already running. They
+  do not hold a dirty scheduler meanwhile: they wait for it in a `receive`. At most 32 callers
+  wait for a same verification, the next ones compute it again.
+
+  The passwords are not kept: the verifications in flight are identified by a keyed hash
+  (SipHash, with a random key drawn when the NIF is loaded) of the hash and the password.
+
+  The result is a map with the following keys:
+
+    * computed: the number of verifications actually computed
+    * saved: the number of verifications which reused the result of an identical one in flight
+      (`verify_and_upgrade/3` and `verify_and_upgrade_async/3` do not, they compute it again)
+    * in_flight: the number of verifications currently computed
+
+  Note that the verifications batched by `ExPassword.Bcrypt.Coalescer` are not counted.
+  """
+  def single_flight do
+    Base.single_flight_nif()
+  end
 end
@@ -5,6 +5,14 @@ defmodule ExPassword.Bcrypt.Application do
   def start(_type, _args) do
     ExPassword.Registry.register_algorithm(ExPassword.Bcrypt)
 
-    Supervisor.start_link([], strategy: :one_for_one)
+    children =
+      case Application.fetch_env(:expassword_bcrypt, :coalescer) do
+        {:ok, options} ->
+          [{ExPassword.Bcrypt.Coalescer, options}]
+        :error ->
+          []
+      end
+
+    Supervisor.start_link(children, strategy: :one_for_one)
   end
 end
@@ -26,9 +26,50 @@ defmodule ExPassword.Bcrypt.Base do
   def hash_nif(password, salt)
   def hash_nif(_password, _salt), do: :erlang.nif_error(:not_loaded)
 
+  def hash_password_nif(password, options)
+  def hash_password_nif(_password, _options), do: :erlang.nif_error(:not_loaded)
+
+  def hash_many_nif(passwords, options)
+  def hash_many_nif(_passwords, _options), do: :erlang.nif_error(:not_loaded)
+
   def verify_nif(password, hash)
   def verify_nif(_password, _hash), do: :erlang.nif_error(:not_loaded)
 
+  # verify_nif/2 returns {:wait, ref} when an identical verification is already running (see
+  # ExPassword.Bcrypt.single_flight/0): its result is sent to the caller once it is done
+  def verify(password, hash) do
+    case verify_nif(password, hash) do
+      {:wait, ref} ->
+        receive do
+          {:bcrypt_verified, ^ref, result} ->
+            result
+        end
+      result ->
+        result
+    end
+  end
+
+  def verify_and_upgrade_nif(password, hash, options)
+  def verify_and_upgrade_nif(_password, _hash, _options), do: :erlang.nif_error(:not_loaded)
+
+  def verify_and_upgrade_async_nif(password, hash, options)
+  def verify_and_upgrade_async_nif(_password, _hash, _options), do: :erlang.nif_error(:not_loaded)
+
+  def parse_hash_nif(hash)
+  def parse_hash_nif(_hash), do: :erlang.nif_error(:not_loaded)
+
+  def verify_parsed_nif(password, parsed)
+  def verify_parsed_nif(_password, _parsed), do: :erlang.nif_error(:not_loaded)
+
+  def verify_many_nif(pairs)
+  def verify_many_nif(_pairs), do: :erlang.nif_error(:not_loaded)
+
+  def matches_any_nif(password, hashes)
+  def matches_any_nif(_password, _hashes), do: :erlang.nif_error(:not_loaded)
+
+  def verify_any_nif(candidates, hash)
+  def verify_any_nif(_candidates, _hash), do: :erlang.nif_error(:not_loaded)
+
   def get_options_nif(hash)
   def get_options_nif(_hash), do: :erlang.nif_error(:not_loaded)
 
@@ -38,6 +79,18 @@ defmodule ExPassword.Bcrypt.Base do
   def valid_nif(hash)
   def valid_nif(_hash), do: :erlang.nif_error(:not_loaded)
 
+  def inspect_many_nif(hashes, options)
+  def inspect_many_nif(_hashes, _options), do: :erlang.nif_error(:not_loaded)
+
+  def kernel_info_nif()
+  def kernel_info_nif(), do: :erlang.nif_error(:not_loaded)
+
+  def utilization_nif()
+  def utilization_nif(), do: :erlang.nif_error(:not_loaded)
+
+  def single_flight_nif()
+  def single_flight_nif(), do: :erlang.nif_error(:not_loaded)
+
   if false do
     def encode_base64_nif(data)
     def encode_base64_nif(_data), do: :erlang.nif_error(:not_loaded)
@@ -0,0 +1,186 @@
+defmodule ExPassword.Bcrypt.Coalescer do
+  @moduledoc ~S"""
+  Coalesces concurrent calls to `ExPassword.Bcrypt.verify?/2` into batches computed by a single
+  call to the NIF (see `ExPassword.Bcrypt.verify_many?/1`) so the lanes of the selected kernel
+  are kept busy without any change to the callers.
+
+  It is started by the application when the `:coalescer` key is set in its environment:
+
+  ```elixir
+  config :expassword_bcrypt,
+    coalescer: [
+      # the maximum number of requests in a batch (defaults to the lanes of the selected kernel)
+      max_batch: 16,
+    ]
+  ```
+
+  A request received while no batch is running is run at once, alone: nothing is gained by holding
+  it back. The requests received while a batch is running are held until it is done then run
+  together as the next batch, or as soon as *max_batch* of them are pending.
+
+  Each batch is run by its own process, so the coalescer keeps collecting requests meanwhile. This
+  process is monitored: if it dies before handing its results back, the batch is run once more,
+  password by password, and if that process dies too, its callers exit with the same reason
+  instead of waiting forever.
+  """
+
+  use GenServer
+
+  alias ExPassword.Bcrypt.Base
+
+  defstruct ~W[max_batch pending count batches requests running]a
+
+  @doc false
+  def start_link(options) do
+    GenServer.start_link(__MODULE__, options, name: __MODULE__)
+  end
+
+  @doc false
+  def child_spec(options) do
+    %{
+      id: __MODULE__,
+      start: {__MODULE__, :start_link, [options]},
+    }
+  end
+
+  @doc ~S"""
+  Returns `true` if the coalescer is running.
+  """
+  def running? do
+    nil != Process.whereis(__MODULE__)
+  end
+
+  @doc ~S"""
+  Checks, as part of the next batch, that *password* matches *hash* (which has to be a valid bcrypt
+  hash).
+  """
+  def verify?(password, hash) do
+    case GenServer.call(__MODULE__, {:verify, password, hash}, :infinity) do
+      {:ok, result} ->
+        result
+      {:raise, exception} ->
+        raise exception
+      {:exit, reason} ->
+        exit(reason)
+    end
+  end
+
+  @doc ~S"""
+  Returns the statistics of the coalescer, a map with the following keys:
+
+    * batches: the number of batches run
+    * requests: the number of requests (passwords checked) handled by these batches
+    * max_batch: the maximum number of requests in a batch
+    * fill_ratio: the average number of requests per batch divided by *max_batch* (0.0 if no batch
+      was run yet)
+  """
+  def stats do
+    GenServer.call(__MODULE__, :stats)
+  end
+
+  @impl GenServer
+  def init(options) do
+    max_batch = Keyword.get_lazy(options, :max_batch, fn -> Base.kernel_info_nif().lanes end)
+
+    {:ok, %__MODULE__{max_batch: max_batch, pending: [], count: 0, batches: 0, requests: 0, running: %{}}}
+  end
+
+  @impl GenServer
+  def handle_call({:verify, password, hash}, from, state = %__MODULE__{}) do
+    state = %__MODULE__{state | pending: [{from, {password, hash}} | state.pending], count: state.count + 1}
+
+    if state.count >= state.max_batch or 0 == map_size(state.running) do
+      state
+      |> flush()
+      |> noreply()
+    else
+      noreply(state)
+    end
+  end
+
+  def handle_call(:stats, _from, state = %__MODULE__{}) do
+    fill_ratio =
+      if state.batches > 0 do
+        state.requests / (state.batches * state.max_batch)
+      else
+        0.0
+      end
+
+    {:reply, %{batches: state.batches, requests: state.requests, max_batch: state.max_batch, fill_ratio: fill_ratio}, state}
+  end
+
+  @impl GenServer
+  def handle_info({:verified, pid, results}, state = %__MODULE__{}) do
+    {{ref, callers, _pairs, _retry}, running} = Map.pop(state.running, pid)
+    Process.demonitor(ref, [:flush])
+    reply(callers, results)
+
+    # the requests held back while it was running
+    %__MODULE__{state | running: running}
+    |> flush()
+    |> noreply()
+  end
+
+  # the process running a batch died before sending its results back
+  def handle_info({:DOWN, _ref, :process, pid, reason}, state = %__MODULE__{}) do
+    {{_ref, callers, pairs, retry}, running} = Map.pop(state.running, pid)
+
+    if retry do
+      reply(callers, Enum.map(callers, fn _ -> {:exit, reason} end))
+
+      %__MODULE__{state | running: running}
+      |> flush()
+      |> noreply()
+    else
+      noreply(%__MODULE__{state | running: run(running, callers, pairs, true)})
+    end
+  end
+
+  defp noreply(state), do: {:noreply, state}
+
+  defp flush(state = %__MODULE__{count: 0}), do: state
+
+  defp flush(state = %__MODULE__{}) do
+    {callers, pairs} =
+      state.pending
+      |> Enum.reverse()
+      |> Enum.unzip()
+    running = run(state.running, callers, pairs, false)
+
+    %__MODULE__{state | pending: [], count: 0, batches: state.batches + 1, requests: state.requests + state.count, running: running}
+  end
+
+  # the results are sent back to the coalescer, which replies, so they are not lost with the process
+  defp run(running, callers, pairs, retry) do
+    coalescer = self()
+    {pid, ref} =
+      spawn_monitor(fn ->
+        results = if retry, do: Enum.map(pairs, &verify_one/1), else: verify_batch(pairs)
+        send(coalescer, {:verified, self(), results})
+      end)
+
+    Map.put(running, pid, {ref, callers, pairs, retry})
+  end
+
+  defp verify_batch(pairs) do
+    pairs
+    |> Base.verify_many_nif()
+    |> Enum.map(&{:ok, &1})
+  rescue
+    _ ->
+      Enum.map(pairs, &verify_one/1)
+  end
+
+  defp verify_one({password, hash}) do
+    {:ok, Base.verify(password, hash)}
+  rescue
+    exception ->
+      {:raise, exception}
+  end
+
+  defp reply(callers, results) do
+    callers
+    |> Enum.zip(results)
+    |> Enum.each(fn {from, result} -> GenServer.reply(from, result) end)
+  end
+end
@@ -0,0 +1,167 @@
+if Code.ensure_loaded?(GenStage) do
+  defmodule ExPassword.Bcrypt.Stage do
+    @moduledoc ~S"""
+    A `GenStage` producer-consumer which hashes or verifies the passwords it receives by batches
+    computed by a single call to the NIF (see `ExPassword.Bcrypt.hash_many/2` and
+    `ExPassword.Bcrypt.verify_many?/1`) instead of a call to `ExPassword.Bcrypt.hash/2` or
+    `ExPassword.Bcrypt.verify?/2` per password. It is only defined when the optional dependency
+    `:gen_stage` is available.
+
+    Options:
+
+      * mode: `:hash` (default) to hash `{id, password}` events into `{id, hash}` ones or `:verify`
+        to check `{id, password, hash}` events into `{id, boolean}` ones (`{id, :error}` if the
+        hash is invalid)
+      * options: for `:hash`, the options given to `ExPassword.Bcrypt.hash_many/2` (required)
+      * batch_size: the number of passwords computed by a call to the NIF, defaults to
+        `batch_size/0`
+      * subscribe_to: the producers to subscribe to, as for `GenStage`. Unless set, *max_demand*
+        defaults to twice *batch_size* and *min_demand* to *batch_size* so the events are received,
+        and computed, by batches of *batch_size*
+      * name: the name to register the stage under
+
+    The demand is only sent upstream once a batch is computed, so a slow stage applies backpressure
+    to its producers: run as many of them as the node has CPUs (with a `GenStage.PartitionDispatcher`
+    or a `GenStage.DemandDispatcher` upstream) to keep every core busy.
+
+    Broadway processors are not stages which can be replaced: in a Broadway pipeline, call
+    `ExPassword.Bcrypt.hash_many/2` or `ExPassword.Bcrypt.verify_many?/1` from `handle_batch/4`
+    with a `batch_size` of `batch_size/0`.
+
+    When `:telemetry` is available, a `[:expassword_bcrypt, :stage, :batch]` event is emitted after
+    each batch with a count (of passwords) and a duration (in native time unit) as measurements and
+    the mode and the batch size as metadata. `stats/1` reports the same figures cumulated.
+    """
+
+    use GenStage
+
+    alias ExPassword.Bcrypt.Base
+
+    defstruct ~W[mode options batch_size batches events duration]a
+
+    @doc ~S"""
+    Starts the stage, see above for the options.
+    """
+    def start_link(options) do
+      {gen_options, options} = Keyword.split(options, ~W[name]a)
+      GenStage.start_link(__MODULE__, options, gen_options)
+    end
+
+    @doc ~S"""
+    Returns the number of lanes of the selected kernel (see `ExPassword.Bcrypt.kernel_info/0`), the
+    default size of the batches.
+    """
+    def batch_size do
+      Base.kernel_info_nif().lanes
+    end
+
+    @doc ~S"""
+    Returns the statistics of *stage*, a map with the following keys:
+
+      * batches: the number of batches computed
+      * events: the number of passwords hashed or verified by these batches
+      * batch_size: the maximum number of passwords in a batch
+      * fill_ratio: the average number of passwords per batch divided by *batch_size* (0.0 if no
+        batch was computed yet)
+      * rate: the number of passwords computed per second spent in the NIF (0.0 if no batch was
+        computed yet)
+    """
+    def stats(stage) do
+      GenStage.call(stage, :stats)
+    end
+
+    @impl GenStage
+    def init(options) do
+      mode = Keyword.get(options, :mode, :hash)
+      hash_options = Keyword.get(options, :options)
+      unless :verify == mode or (:hash == mode and match?(%{cost: cost} when is_integer(cost) and cost >= 4 and cost <= 31, hash_options)) do
+        raise ArgumentError, "invalid mode or options for #{inspect(__MODULE__)}: #{inspect(options)}"
+      end
+      batch_size = Keyword.get_lazy(options, :batch_size, &batch_size/0)
+      defaults = [max_demand: 2 * batch_size, min_demand: batch_size]
+      subscribe_to =
+        options
+        |> Keyword.get(:subscribe_to, [])
+        |> Enum.map(fn
+          {producer, subscription} when is_list(subscription) ->
+            {producer, Keyword.merge(defaults, subscription)}
+          producer ->
+            {producer, defaults}
+        end)
+
+      {:producer_consumer, %__MODULE__{mode: mode, options: hash_options, batch_size: batch_size, batches: 0, events: 0, duration: 0}, subscribe_to: subscribe_to}
+    end
+
+    @impl GenStage
+    def handle_events(events, _from, state = %__MODULE__{}) do
+      {results, state} =
+        events
+        |> Enum.chunk_every(state.batch_size)
+        |> Enum.flat_map_reduce(state, &run_batch/2)
+
+      {:noreply, results, state}
+    end
+
+    @impl GenStage
+    def handle_call(:stats, _from, state = %__MODULE__{}) do
+      {fill_ratio, rate} =
+        if state.batches > 0 do
+          seconds = System.convert_time_unit(state.duration, :native, :microsecond) / 1_000_000
+          {state.events / (state.batches * state.batch_size), if(seconds > 0, do: state.events / seconds, else: 0.0)}
+        else
+          {0.0, 0.0}
+        end
+      stats = %{batches: state.batches, events: state.events, batch_size: state.batch_size, fill_ratio: fill_ratio, rate: rate}
+
+      {:reply, stats, [], state}
+    end
+
+    defp run_batch(batch, state = %__MODULE__{}) do
+      start = System.monotonic_time()
+      results = compute(state.mode, batch, state.options)
+      duration = System.monotonic_time() - start
+      count = length(batch)
+      emit(%{count: count, duration: duration}, %{mode: state.mode, batch_size: state.batch_size})
+
+      {results, %__MODULE__{state | batches: state.batches + 1, events: state.events + count, duration: state.duration + duration}}
+    end
+
+    defp compute(:hash, batch, options) do
+      {ids, passwords} = Enum.unzip(batch)
+
+      Enum.zip(ids, ExPassword.Bcrypt.hash_many(passwords, options))
+    end
+
+    defp compute(:verify, batch, _options) do
+      {ids, pairs} =
+        batch
+        |> Enum.map(fn {id, password, hash} -> {id, {password, hash}} end)
+        |> Enum.unzip()
+      results =
+        try do
+          Base.verify_many_nif(pairs)
+        rescue
+          ArgumentError ->
+            # an invalid hash fails the whole batch: find which one(s)
+            Enum.map(pairs, &verify/1)
+        end
+
+      Enum.zip(ids, results)
+    end
+
+    defp verify({password, hash}) do
+      Base.verify(password, hash)
+    rescue
+      ArgumentError ->
+        :error
+    end
+
+    if Code.ensure_loaded?(:telemetry) do
+      defp emit(measurements, metadata) do
+        :telemetry.execute([:expassword_bcrypt, :stage, :batch], measurements, metadata)
+      end
+    else
+      defp emit(_measurements, _metadata), do: :ok
+    end
+  end
+end
@@ -1,9 +1,26 @@
 ATOM(true)
 ATOM(false)
+ATOM(nil)
 ATOM(ok)
 ATOM(error)
 ATOM(invalid)
 ATOM(cost)
+ATOM(kernel)
+ATOM(kernels)
+ATOM(name)
+ATOM(lanes)
+ATOM(supported)
+ATOM(rate)
+ATOM(backend)
+ATOM(iterations)
+ATOM(busy)
+ATOM(computed)
+ATOM(saved)
+ATOM(in_flight)
+ATOM(bcrypt_rehashed)
+ATOM(deferred)
+ATOM(wait)
+ATOM(bcrypt_verified)
 // ATOM(message)
 // ATOM(__exception__)
 // ATOM(__struct__)
@@ -0,0 +1,407 @@
+/**
+ * bcrypt_audit: checks every bcrypt hash of a dump (one hash per line or
+ * one column of a CSV file) and reports the distribution of their costs
+ * and minor versions, the malformed lines and the hashes sharing their
+ * salt with another one.
+ *
+ * usage: bcrypt_audit [-c column] [-d delimiter] [-H] [-t threads] file
+ *
+ *   -c: the (1-based) column of the hashes when the file is a CSV one
+ *   -d: the delimiter of the columns (default: ',')
+ *   -H: skip the first line (a header)
+ *   -t: the number of threads (default: the number of online CPUs)
+ *
+ * The file is mapped in memory and split in as many chunks (on line
+ * boundaries) as threads, each one checking its lines with the same
+ * validation as the NIF (bcrypt_inspect_hash). For the duplicates, each
+ * thread then buckets the raw salts of its valid hashes by their first
+ * byte and finally, for a range of these byte values, gathers the salts
+ * of the bucket of every thread and sorts them to find the duplicates.
+ * Keep in mind that these salts take 16 bytes per hash.
+ */
+#if !defined(_GNU_SOURCE)
+# define _GNU_SOURCE /* madvise, getopt */
+#endif /* !_GNU_SOURCE */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
+
+extern int bcrypt_inspect_hash(const uint8_t *hash);
+extern uint8_t *decode_base64(const uint8_t *data, const uint8_t * const data_end, uint8_t *buffer, const uint8_t * const buffer_end);
+
+#define HASH_SIZE (BCRYPT_HASHSPACE - 1)
+#define COST_MAX 31
+#define THREADS_MAX 256
+#define MALFORMED_REPORTED 10 /* line numbers of malformed lines printed */
+
+typedef struct {
+    uint8_t bytes[BCRYPT_MAXSALT];
+} audit_salt_t;
+
+typedef struct {
+    // the lines [begin;end[ to check
+    const uint8_t *begin, *end;
+    size_t lines, valid, malformed;
+    size_t costs[COST_MAX + 1];
+    size_t minors['z' - 'a' + 1];
+    // (1-based) numbers, relative to begin, of the first malformed lines
+    size_t malformed_lines[MALFORMED_REPORTED];
+    // the salts of the valid hashes, bucketed by their first byte once the chunk is checked
+    audit_salt_t *salts;
+    size_t salts_count, salts_capacity, buckets[256 + 1];
+    // duplicates of the salts which start by [first;last] among all the chunks
+    int first, last;
+    size_t duplicates;
+    bool failed;
+} audit_chunk_t;
+
+static struct {
+    int column;
+    char delimiter;
+    bool header;
+    size_t threads;
+    audit_chunk_t *chunks;
+} audit = { 0, ',', false, 0, NULL };
+
+static int audit_salt_compare(const void *a, const void *b)
+{
+    return memcmp(a, b, sizeof(audit_salt_t));
+}
+
+// returns the hash of the line [line;eol[, its end being written to *field_end
+static const uint8_t *audit_field(const uint8_t *line, const uint8_t *eol, const uint8_t **field_end)
+{
+    int column;
+    const uint8_t *r;
+
+    if (line < eol && '\r' == eol[-1]) {
+        --eol;
+    }
+    for (column = 1; column < audit.column && NULL != line; column++) {
+        if (NULL != (line = memchr(line, audit.delimiter, eol - line))) {
+            ++line;
+        }
+    }
+    if (NULL == line) {
+        // not enough columns
+        *field_end = eol;
+        return eol;
+    }
+    if (audit.column > 0 && NULL != (r = memchr(line, audit.delimiter, eol - line))) {
+        eol = r;
+    }
+    if (eol - line >= 2 && '"' == line[0] && '"' == eol[-1]) {
+        ++line;
+        --eol;
+    }
+    *field_end = eol;
+
+    return line;
+}
+
+// counting sort of the salts of *chunk* on their first byte
+static void audit_bucket(audit_chunk_t *chunk)
+{
+    size_t i, next[256];
+    audit_salt_t *salts;
+
+    if (NULL == (salts = malloc(chunk->salts_count * sizeof(*salts) + 1))) {
+        chunk->failed = true;
+        return;
+    }
+    for (i = 0; i < chunk->salts_count; i++) {
+        ++chunk->buckets[chunk->salts[i].bytes[0] + 1];
+    }
+    for (i = 0; i < ARRAY_SIZE(next); i++) {
+        chunk->buckets[i + 1] += chunk->buckets[i];
+        next[i] = chunk->buckets[i];
+    }
+    for (i = 0; i < chunk->salts_count; i++) {
+        salts[next[chunk->salts[i].bytes[0]]++] = chunk->salts[i];
+    }
+    free(chunk->salts);
+    chunk->salts = salts;
+}
+
+static void *audit_check(void *arg)
+{
+    audit_chunk_t *chunk = arg;
+    const uint8_t *line, *eol;
+
+    chunk->salts_capacity = (chunk->end - chunk->begin) / (HASH_SIZE + 1) + 1;
+    if (NULL == (chunk->salts = malloc(chunk->salts_capacity * sizeof(*chunk->salts)))) {
+        chunk->failed = true;
+        return NULL;
+    }
+    for (line = chunk->begin; line < chunk->end; line = eol + 1) {
+        int cost;
+        const uint8_t *field, *field_end;
+
+        if (NULL == (eol = memchr(line, '\n', chunk->end - line))) {
+            eol = chunk->end;
+        }
+        ++chunk->lines;
+        if (line == eol || (line + 1 == eol && '\r' == *line)) {
+            // blank line
+            continue;
+        }
+        field = audit_field(line, eol, &field_end);
+        if (HASH_SIZE == field_end - field && 0 != (cost = bcrypt_inspect_hash(field))) {
+            ++chunk->valid;
+            ++chunk->costs[cost];
+            ++chunk->minors[field[2] - 'a'];
+            if (chunk->salts_count == chunk->salts_capacity) {
+                audit_salt_t *salts;
+
+                if (NULL == (salts = realloc(chunk->salts, 2 * chunk->salts_capacity * sizeof(*chunk->salts)))) {
+                    chunk->failed = true;
+                    return NULL;
+                }
+                chunk->salts = salts;
+                chunk->salts_capacity *= 2;
+            }
+            decode_base64(field + STR_LEN("$vm$cc$"), field + BCRYPT_SALTSPACE, chunk->salts[chunk->salts_count].bytes, chunk->salts[chunk->salts_count].bytes + BCRYPT_MAXSALT);
+            ++chunk->salts_count;
+        } else {
+            if (chunk->malformed < MALFORMED_REPORTED) {
+                chunk->malformed_lines[chunk->malformed] = chunk->lines;
+            }
+            ++chunk->malformed;
+        }
+    }
+    audit_bucket(chunk);
+
+    return NULL;
+}
+
+static void *audit_duplicates(void *arg)
+{
+    int byte;
+    size_t i, count, max;
+    audit_salt_t *salts;
+    audit_chunk_t *chunk = arg;
+
+    max = 0;
+    for (byte = chunk->first; byte <= chunk->last; byte++) {
+        count = 0;
+        for (i = 0; i < audit.threads; i++) {
+            count += audit.chunks[i].buckets[byte + 1] - audit.chunks[i].buckets[byte];
+        }
+        max = count > max ? count : max;
+    }
+    if (NULL == (salts = malloc(max * sizeof(*salts) + 1))) {
+        chunk->failed = true;
+        return NULL;
+    }
+    for (byte = chunk->first; byte <= chunk->last; byte++) {
+        count = 0;
+        for (i = 0; i < audit.threads; i++) {
+            const audit_chunk_t *source = &audit.chunks[i];
+
+            memcpy(salts + count, source->salts + source->buckets[byte], (source->buckets[byte + 1] - source->buckets[byte]) * sizeof(*salts));
+            count += source->buckets[byte + 1] - source->buckets[byte];
+        }
+        qsort(salts, count, sizeof(*salts), audit_salt_compare);
+        for (i = 1; i < count; i++) {
+            if (0 == audit_salt_compare(&salts[i - 1], &salts[i])) {
+                ++chunk->duplicates;
+            }
+        }
+    }
+    free(salts);
+
+    return NULL;
+}
+
+// runs *fn* on each chunk, in its own thread
+static bool audit_run(void *(*fn)(void *))
+{
+    size_t i;
+    bool ok, created[THREADS_MAX];
+    pthread_t threads[THREADS_MAX];
+
+    ok = true;
+    for (i = 0; i < audit.threads; i++) {
+        if (!(created[i] = 0 == pthread_create(&threads[i], NULL, fn, &audit.chunks[i]))) {
+            fn(&audit.chunks[i]);
+        }
+    }
+    for (i = 0; i < audit.threads; i++) {
+        if (created[i]) {
+            pthread_join(threads[i], NULL);
+        }
+        ok &= !audit.chunks[i].failed;
+    }
+
+    return ok;
+}
+
+static void audit_usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-c column] [-d delimiter] [-H] [-t threads] file\n", name);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    int c, fd;
+    struct stat st;
+    double elapsed;
+    const uint8_t *data, *r;
+    struct timespec start, now;
+    size_t i, lines, valid, malformed, reported, duplicates, costs[COST_MAX + 1], minors['z' - 'a' + 1];
+
+    while (-1 != (c = getopt(argc, argv, "c:d:Ht:"))) {
+        switch (c) {
+            case 'c':
+                if ((audit.column = atoi(optarg)) < 1) {
+                    audit_usage(argv[0]);
+                }
+                break;
+            case 'd':
+                if (1 != strlen(optarg)) {
+                    audit_usage(argv[0]);
+                }
+                audit.delimiter = optarg[0];
+                break;
+            case 'H':
+                audit.header = true;
+                break;
+            case 't':
+                if (atoi(optarg) < 1 || atoi(optarg) > THREADS_MAX) {
+                    audit_usage(argv[0]);
+                }
+                audit.threads = atoi(optarg);
+                break;
+            default:
+                audit_usage(argv[0]);
+        }
+    }
+    if (optind + 1 != argc) {
+        audit_usage(argv[0]);
+    }
+    if (0 == audit.threads) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        audit.threads = cpus < 1 ? 1 : cpus > THREADS_MAX ? THREADS_MAX : (size_t) cpus;
+    }
+
+    if (-1 == (fd = open(argv[optind], O_RDONLY)) || -1 == fstat(fd, &st)) {
+        fprintf(stderr, "%s: %s: %s\n", argv[0], argv[optind], strerror(errno));
+        return EXIT_FAILURE;
+    }
+    data = NULL;
+    if (st.st_size > 0) {
+        if (MAP_FAILED == (data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))) {
+            fprintf(stderr, "%s: %s: %s\n", argv[0], argv[optind], strerror(errno));
+            return EXIT_FAILURE;
+        }
+        madvise((void *) data, st.st_size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (NULL == (audit.chunks = calloc(audit.threads, sizeof(*audit.chunks)))) {
+        fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+        return EXIT_FAILURE;
+    }
+    // split the file on line boundaries
+    r = data;
+    if (audit.header && st.st_size > 0) {
+        r = memchr(data, '\n', st.st_size);
+        r = NULL == r ? data + st.st_size : r + 1;
+    }
+    for (i = 0; i < audit.threads; i++) {
+        const uint8_t *end = data + st.st_size;
+
+        audit.chunks[i].begin = r;
+        if (i + 1 < audit.threads && r < end) {
+            const uint8_t *boundary = data + (st.st_size / audit.threads) * (i + 1);
+
+            if (boundary > r) {
+                end = memchr(boundary, '\n', data + st.st_size - boundary);
+                end = NULL == end ? data + st.st_size : end + 1;
+            } else {
+                end = r;
+            }
+        }
+        audit.chunks[i].end = r = end;
+        // for the duplicates: the salts starting by the i-th range of byte values
+        audit.chunks[i].first = 256 * i / audit.threads;
+        audit.chunks[i].last = 256 * (i + 1) / audit.threads - 1;
+    }
+    if (!audit_run(audit_check) || !audit_run(audit_duplicates)) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (double) (now.tv_sec - start.tv_sec) + (double) (now.tv_nsec - start.tv_nsec) / 1e9;
+
+    valid = malformed = reported = duplicates = 0;
+    memset(costs, 0, sizeof(costs));
+    memset(minors, 0, sizeof(minors));
+    for (i = 0; i < audit.threads; i++) {
+        size_t j;
+        const audit_chunk_t *chunk = &audit.chunks[i];
+
+        for (j = 0; j < ARRAY_SIZE(costs); j++) {
+            costs[j] += chunk->costs[j];
+        }
+        for (j = 0; j < ARRAY_SIZE(minors); j++) {
+            minors[j] += chunk->minors[j];
+        }
+        valid += chunk->valid;
+        malformed += chunk->malformed;
+        duplicates += chunk->duplicates;
+    }
+
+    printf("hashes: %zu valid, %zu malformed\n", valid, malformed);
+    printf("costs:\n");
+    for (i = 0; i < ARRAY_SIZE(costs); i++) {
+        if (0 != costs[i]) {
+            printf("  %02zu: %zu (%.2f%%)\n", i, costs[i], 100.0 * costs[i] / valid);
+        }
+    }
+    printf("minor versions:\n");
+    for (i = 0; i < ARRAY_SIZE(minors); i++) {
+        if (0 != minors[i]) {
+            printf("  $2%c$: %zu (%.2f%%)\n", (char) ('a' + i), minors[i], 100.0 * minors[i] / valid);
+        }
+    }
+    printf("duplicate salts: %zu\n", duplicates);
+    lines = audit.header ? 1 : 0;
+    for (i = 0; i < audit.threads && reported < MALFORMED_REPORTED; i++) {
+        size_t j;
+        const audit_chunk_t *chunk = &audit.chunks[i];
+
+        for (j = 0; j < chunk->malformed && j < MALFORMED_REPORTED && reported < MALFORMED_REPORTED; j++, reported++) {
+            printf("malformed line %zu\n", lines + chunk->malformed_lines[j]);
+        }
+        lines += chunk->lines;
+    }
+    if (malformed > reported) {
+        printf("(%zu more malformed lines)\n", malformed - reported);
+    }
+    fprintf(stderr, "%.1f MB checked in %.3f s by %zu threads (%.1f MB/s)\n", st.st_size / 1e6, elapsed, audit.threads, st.st_size / 1e6 / elapsed);
+
+    for (i = 0; i < audit.threads; i++) {
+        free(audit.chunks[i].salts);
+    }
+    free(audit.chunks);
+    if (NULL != data) {
+        munmap((void *) data, st.st_size);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,362 @@
+/**
+ * bcrypt: hashes and verifies passwords in bulk, outside of the BEAM
+ * (offline migrations, capacity tests, ...).
+ *
+ * usage: bcrypt [-t threads] [-b block] < records > results
+ *
+ *   -t: the number of threads computing the hashes (default: the number
+ *       of online CPUs)
+ *   -b: the number of records handed to a thread at once (default: 4
+ *       times the lanes of the selected kernel)
+ *
+ * Each line read from stdin is a record made of a password, a tab then
+ * either a cost, to hash the password (with a random salt, version $2b$),
+ * or a hash, to verify the password against it. For each record, a line
+ * is written to stdout, in the same order: the hash, true or false for a
+ * verification or error if the record is invalid. The throughput is
+ * reported on stderr at the end.
+ *
+ * The records are read by blocks, each block is computed by a thread of
+ * the pool as a batch of the selected kernel (bcrypt_hash_many) and the
+ * results are written as soon as the ones of the previous blocks are.
+ */
+#if !defined(_GNU_SOURCE)
+# define _GNU_SOURCE /* getline, getopt */
+#endif /* !_GNU_SOURCE */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "eksblowfish.h"
+
+extern uint8_t *bcrypt_init_salt(int minor, int cost, const uint8_t *raw_salt, const uint8_t * const raw_salt_end, uint8_t *buffer, const uint8_t * const buffer_end);
+extern int timingsafe_bcmp(const void *b1, const void *b2, size_t n);
+extern bool bcrypt_hash_many(const uint8_t * const *passwords, const uint8_t * const *salts, uint8_t *hashes, bool *computed, size_t count);
+
+#define HASH_SIZE (BCRYPT_HASHSPACE - 1)
+#define THREADS_MAX 256
+
+typedef enum {
+    RECORD_INVALID,
+    RECORD_HASH,
+    RECORD_VERIFY,
+} record_type_t;
+
+typedef struct {
+    // the line, as returned by getline (reused from a block to the next)
+    char *line;
+    size_t capacity;
+    record_type_t type;
+    // for RECORD_HASH, the generated salt
+    uint8_t salt[BCRYPT_SALTSPACE];
+} cli_record_t;
+
+typedef enum {
+    BLOCK_FREE,     // can be filled by the reader
+    BLOCK_READY,    // filled, waiting for a thread of the pool
+    BLOCK_COMPUTED, // waiting for the writer
+} block_state_t;
+
+typedef struct {
+    block_state_t state;
+    size_t count;
+    cli_record_t *records;
+    // arguments and results of bcrypt_hash_many (only the valid records)
+    size_t jobs;
+    const uint8_t **passwords, **salts;
+    uint8_t *hashes;
+    bool *computed;
+} cli_block_t;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    // a ring of blocks: 2 per thread so the reader and the writer do not make the pool wait
+    size_t size;
+    cli_block_t *blocks;
+    size_t block_size;
+    // next block to fill, to compute and to write
+    size_t read, computed, written;
+    bool eof;
+} cli;
+
+static void *cli_worker(void *UNUSED(arg))
+{
+    for (;;) {
+        cli_block_t *block;
+
+        pthread_mutex_lock(&cli.lock);
+        while (cli.computed == cli.read && !cli.eof) {
+            pthread_cond_wait(&cli.cond, &cli.lock);
+        }
+        if (cli.computed == cli.read) {
+            pthread_mutex_unlock(&cli.lock);
+            return NULL;
+        }
+        block = &cli.blocks[cli.computed++ % cli.size];
+        pthread_mutex_unlock(&cli.lock);
+
+        if (!bcrypt_hash_many(block->passwords, block->salts, block->hashes, block->computed, block->jobs)) {
+            memset(block->computed, 0, block->jobs * sizeof(*block->computed));
+        }
+
+        pthread_mutex_lock(&cli.lock);
+        block->state = BLOCK_COMPUTED;
+        pthread_cond_broadcast(&cli.cond);
+        pthread_mutex_unlock(&cli.lock);
+    }
+}
+
+static void *cli_writer(void *UNUSED(arg))
+{
+    for (;;) {
+        size_t i, job;
+        cli_block_t *block;
+
+        pthread_mutex_lock(&cli.lock);
+        // the blocks are written in the order they were read
+        while (!(cli.written < cli.read && BLOCK_COMPUTED == cli.blocks[cli.written % cli.size].state)) {
+            if (cli.written == cli.read && cli.eof) {
+                pthread_mutex_unlock(&cli.lock);
+                return NULL;
+            }
+            pthread_cond_wait(&cli.cond, &cli.lock);
+        }
+        block = &cli.blocks[cli.written % cli.size];
+        pthread_mutex_unlock(&cli.lock);
+
+        for (i = job = 0; i < block->count; i++) {
+            const cli_record_t *record = &block->records[i];
+
+            if (RECORD_INVALID == record->type) {
+                fputs("error\n", stdout);
+                continue;
+            }
+            if (!block->computed[job]) {
+                fputs("error\n", stdout);
+            } else if (RECORD_HASH == record->type) {
+                fwrite(block->hashes + job * HASH_SIZE, 1, HASH_SIZE, stdout);
+                fputc('\n', stdout);
+            } else {
+                fputs(0 == timingsafe_bcmp(block->salts[job], block->hashes + job * HASH_SIZE, HASH_SIZE) ? "true\n" : "false\n", stdout);
+            }
+            ++job;
+        }
+        explicit_bzero(block->hashes, block->jobs * HASH_SIZE);
+        for (i = 0; i < block->count; i++) {
+            explicit_bzero(block->records[i].line, block->records[i].capacity);
+        }
+
+        pthread_mutex_lock(&cli.lock);
+        block->state = BLOCK_FREE;
+        ++cli.written;
+        pthread_cond_broadcast(&cli.cond);
+        pthread_mutex_unlock(&cli.lock);
+    }
+}
+
+// splits *record* into the password and what to do with it
+static void cli_parse(cli_record_t *record, ssize_t length)
+{
+    char *tab, *field;
+    size_t field_length;
+
+    record->type = RECORD_INVALID;
+    while (length > 0 && ('\n' == record->line[length - 1] || '\r' == record->line[length - 1])) {
+        record->line[--length] = '\0';
+    }
+    // the password may contain tabs, not the cost nor the hash
+    if (NULL == (tab = strrchr(record->line, '\t'))) {
+        return;
+    }
+    *tab = '\0';
+    // as the NIFs do: only the first 72 bytes of a password are hashed
+    if (tab - record->line > BCRYPT_MAX_KEY_LEN) {
+        record->line[BCRYPT_MAX_KEY_LEN] = '\0';
+    }
+    field = tab + 1;
+    field_length = strlen(field);
+    if ('$' == field[0]) {
+        if (HASH_SIZE == field_length) {
+            record->type = RECORD_VERIFY;
+        }
+    } else if (field_length >= 1 && field_length <= 2 && strspn(field, "0123456789") == field_length) {
+        uint8_t raw_salt[BCRYPT_MAXSALT];
+        int cost = atoi(field);
+
+        // bcrypt_init_salt clamps the cost, we reject it instead
+        if (
+               cost >= 4 && cost <= 31
+            && 0 == getentropy(raw_salt, sizeof(raw_salt))
+            && NULL != bcrypt_init_salt('b', cost, raw_salt, raw_salt + STR_SIZE(raw_salt), record->salt, record->salt + STR_SIZE(record->salt))
+        ) {
+            record->type = RECORD_HASH;
+        }
+        explicit_bzero(raw_salt, sizeof(raw_salt));
+    }
+}
+
+static bool cli_allocate(cli_block_t *block, size_t size)
+{
+    return
+           NULL != (block->records = calloc(size, sizeof(*block->records)))
+        && NULL != (block->passwords = calloc(size, sizeof(*block->passwords)))
+        && NULL != (block->salts = calloc(size, sizeof(*block->salts)))
+        && NULL != (block->hashes = calloc(size, HASH_SIZE))
+        && NULL != (block->computed = calloc(size, sizeof(*block->computed)))
+    ;
+}
+
+static void cli_usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-t threads] [-b block] < records > results\n", name);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    int c;
+    double elapsed;
+    bool reading;
+    size_t i, threads, records;
+    pthread_t pool[THREADS_MAX], writer;
+    struct timespec start, now;
+
+    threads = 0;
+    cli.block_size = 0;
+    while (-1 != (c = getopt(argc, argv, "t:b:"))) {
+        switch (c) {
+            case 't':
+                if (atoi(optarg) < 1 || atoi(optarg) > THREADS_MAX) {
+                    cli_usage(argv[0]);
+                }
+                threads = atoi(optarg);
+                break;
+            case 'b':
+                if (atoi(optarg) < 1) {
+                    cli_usage(argv[0]);
+                }
+                cli.block_size = atoi(optarg);
+                break;
+            default:
+                cli_usage(argv[0]);
+        }
+    }
+    if (optind != argc) {
+        cli_usage(argv[0]);
+    }
+    if (0 == threads) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        threads = cpus < 1 ? 1 : cpus > THREADS_MAX ? THREADS_MAX : (size_t) cpus;
+    }
+    // pick the fastest EksBlowfish kernel for the CPU we are running on
+    eksblowfish_autotune();
+    if (0 == cli.block_size) {
+        cli.block_size = 4 * eksblowfish_kernel()->lanes;
+    }
+
+    cli.size = 2 * threads;
+    if (NULL == (cli.blocks = calloc(cli.size, sizeof(*cli.blocks)))) {
+        fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < cli.size; i++) {
+        if (!cli_allocate(&cli.blocks[i], cli.block_size)) {
+            fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+    pthread_mutex_init(&cli.lock, NULL);
+    pthread_cond_init(&cli.cond, NULL);
+    if (0 != pthread_create(&writer, NULL, cli_writer, NULL)) {
+        fprintf(stderr, "%s: could not create the writer thread\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < threads; i++) {
+        if (0 != pthread_create(&pool[i], NULL, cli_worker, NULL)) {
+            fprintf(stderr, "%s: could not create the threads\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    records = 0;
+    reading = true;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (reading) {
+        cli_block_t *block;
+
+        pthread_mutex_lock(&cli.lock);
+        while (BLOCK_FREE != cli.blocks[cli.read % cli.size].state) {
+            pthread_cond_wait(&cli.cond, &cli.lock);
+        }
+        block = &cli.blocks[cli.read % cli.size];
+        pthread_mutex_unlock(&cli.lock);
+
+        block->count = block->jobs = 0;
+        while (block->count < cli.block_size) {
+            ssize_t length;
+            cli_record_t *record = &block->records[block->count];
+
+            if (-1 == (length = getline(&record->line, &record->capacity, stdin))) {
+                reading = false;
+                break;
+            }
+            cli_parse(record, length);
+            if (RECORD_HASH == record->type) {
+                block->passwords[block->jobs] = (const uint8_t *) record->line;
+                block->salts[block->jobs++] = record->salt;
+            } else if (RECORD_VERIFY == record->type) {
+                block->passwords[block->jobs] = (const uint8_t *) record->line;
+                block->salts[block->jobs++] = (const uint8_t *) record->line + strlen(record->line) + 1;
+            }
+            ++block->count;
+        }
+        records += block->count;
+
+        pthread_mutex_lock(&cli.lock);
+        if (block->count > 0) {
+            block->state = BLOCK_READY;
+            ++cli.read;
+        }
+        cli.eof = !reading;
+        pthread_cond_broadcast(&cli.cond);
+        pthread_mutex_unlock(&cli.lock);
+    }
+
+    for (i = 0; i < threads; i++) {
+        pthread_join(pool[i], NULL);
+    }
+    pthread_join(writer, NULL);
+    fflush(stdout);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (double) (now.tv_sec - start.tv_sec) + (double) (now.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(
+        stderr,
+        "%zu records in %.3f s (%.1f/s) by %zu threads, kernel %s (%zu lanes)\n",
+        records, elapsed, records / elapsed, threads, eksblowfish_kernel()->name, eksblowfish_kernel()->lanes
+    );
+
+    for (i = 0; i < cli.size; i++) {
+        size_t j;
+
+        for (j = 0; j < cli.block_size; j++) {
+            free(cli.blocks[i].records[j].line);
+        }
+        free(cli.blocks[i].records);
+        free(cli.blocks[i].passwords);
+        free(cli.blocks[i].salts);
+        free(cli.blocks[i].hashes);
+        free(cli.blocks[i].computed);
+    }
+    free(cli.blocks);
+
+    return ferror(stdout) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
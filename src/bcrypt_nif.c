@@ -31,27 +31,40 @@
  *
  */
 
+#if defined(HAVE_SCHED_IDLE) && !defined(_GNU_SOURCE)
+# define _GNU_SOURCE /* SCHED_IDLE */
+#endif /* HAVE_SCHED_IDLE && !_GNU_SOURCE */
 #include <assert.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdbool.h>
 #include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef HAVE_LIBXCRYPT
+# include <crypt.h>
+#endif /* HAVE_LIBXCRYPT */
+#ifdef HAVE_SCHED_IDLE
+# include <pthread.h>
+# include <sched.h>
+#endif /* HAVE_SCHED_IDLE */
 
 #include <erl_nif.h>
 
 #include "blf.h"
 #include "common.h"
+#include "eksblowfish.h"
+#include "siphash.h"
 
 #define BCRYPT_MINOR 'b'
 #define BCRYPT_VERSION '2'
-#define BCRYPT_WORDS 6		/* Ciphertext words */
 #define BCRYPT_MINLOGROUNDS 4	/* we have log2(rounds) in salt */
 
 #define BCRYPT_PREFIX "$2*$"
 #define BCRYPT_MAXLOGROUNDS 31
-#define BCRYPT_MAX_KEY_LEN 72
 
 #ifndef STANDALONE
 # define ATOM(x) \
@@ -262,6 +275,94 @@ EXPORT_IF_STANDALONE const uint8_t *bcrypt_full_parse_hash(const uint8_t *salt,
     return r;
 }
 
+#ifdef HAVE_VECTOR_SIZE_ATTRIBUTE
+typedef uint8_t v16u8 __attribute__((vector_size(16)));
+
+/**
+ * Checks that the 53 characters (salt and digest) of a hash starting at
+ * *data* all belong to the base64 alphabet of bcrypt, 16 at once: their
+ * class is told by 3 unsigned range comparisons instead of looking each
+ * of them up in index_64.
+ */
+static bool bcrypt_valid_base64(const uint8_t *data)
+{
+    size_t i;
+    uint64_t words[2];
+    v16u8 chunks[4], invalid = { 0 };
+
+    // pad the 53 characters with a valid one up to 4 vectors
+    memset(chunks, '.', sizeof(chunks));
+    memcpy(chunks, data, BCRYPT_HASHSPACE - 1 - STR_LEN("$vm$cc$"));
+    for (i = 0; i < ARRAY_SIZE(chunks); i++) {
+        v16u8 c = chunks[i];
+
+        invalid |= (v16u8) ~(
+              ((v16u8) (c - '.') <= '9' - '.')
+            | ((v16u8) (c - 'A') <= 'Z' - 'A')
+            | ((v16u8) (c - 'a') <= 'z' - 'a')
+        );
+    }
+    memcpy(words, &invalid, sizeof(words));
+
+    return 0 == (words[0] | words[1]);
+}
+#else
+static bool bcrypt_valid_base64(const uint8_t *data)
+{
+    size_t i;
+    uint8_t invalid;
+
+    invalid = 0;
+    for (i = 0; i < BCRYPT_HASHSPACE - 1 - STR_LEN("$vm$cc$"); i++) {
+        invalid |= index_64[data[i]];
+    }
+
+    return 0xFF != invalid;
+}
+#endif /* HAVE_VECTOR_SIZE_ATTRIBUTE */
+
+/**
+ * Returns the cost of *hash* (BCRYPT_HASHSPACE - 1 bytes, not NUL
+ * terminated) or 0 if it is not a valid bcrypt hash, without decoding
+ * it: same checks as bcrypt_full_parse_hash plus the ones on the digest
+ * but, for bulk inspection, no branch on the characters of the salt and
+ * the digest.
+ *
+ * The unused bits of the last character of the salt and of the digest
+ * have to be clear: bcrypt_hash would not encode them otherwise, so the
+ * hash could never be matched.
+ */
+EXPORT_IF_STANDALONE int bcrypt_inspect_hash(const uint8_t *hash)
+{
+    int cost;
+    const uint8_t * const r = hash + STR_LEN("$vm$cc$");
+
+    if (
+           '$' != hash[0]
+        || BCRYPT_VERSION != hash[1]
+        || ('a' != hash[2] && 'b' != hash[2] && 'y' != hash[2])
+        || '$' != hash[3]
+        || !isdigit(hash[4])
+        || !isdigit(hash[5])
+        || '$' != hash[6]
+    ) {
+        return 0;
+    }
+    cost = (hash[5] - '0') + ((hash[4] - '0') * 10);
+    if (cost < BCRYPT_MINLOGROUNDS || cost > BCRYPT_MAXLOGROUNDS) {
+        return 0;
+    }
+    if (!bcrypt_valid_base64(r)) {
+        return 0;
+    }
+    // 16 bytes of salt: 4 unused bits, 23 bytes of digest: 2 unused bits
+    if (0 != (index_64[hash[BCRYPT_SALTSPACE - 1]] & 0x0F) || 0 != (index_64[hash[BCRYPT_HASHSPACE - 2]] & 0x03)) {
+        return 0;
+    }
+
+    return cost;
+}
+
 #ifndef STANDALONE
 static bool bcrypt_parse_hash(const ErlNifBinary *hash, int *cost)
 {
@@ -274,125 +375,1427 @@ static bool bcrypt_parse_hash(const ErlNifBinary *hash, int *cost)
         *cost = 0;
     }
 
-    return *cost >= BCRYPT_MINLOGROUNDS && *cost <= BCRYPT_MAXLOGROUNDS;
+    return *cost >= BCRYPT_MINLOGROUNDS && *cost <= BCRYPT_MAXLOGROUNDS;
+}
+#endif /* !STANDALONE */
+
+typedef struct {
+    int minor, cost;
+    uint8_t raw_salt[BCRYPT_MAXSALT];
+    eksblowfish_lane_t lane;
+} bcrypt_state_t;
+
+// number of bytes of the password (\0 included) which are hashed for the given minor
+static bool bcrypt_password_length(
+    int minor,
+    // WARNING: password have to be null terminated and password_end should be located AFTER it!
+    const uint8_t *password, const uint8_t * const password_end,
+    size_t *password_len
+) {
+    if (password > password_end) {
+        return false; // PWD_PTR_MISMATCH
+    }
+    // REMINDER: password_len counts \0
+    *password_len = (password_end - password);
+    if ('a' == minor) {
+        *password_len = (uint8_t) (*password_len);
+    } else if ('b' == minor || 'y' == minor) {
+        if (*password_len > 73) {
+            *password_len = 73;
+        }
+    } else {
+        assert(false);
+        return false; // INCORRECT_TYPE
+    }
+
+    return true;
+}
+
+static bool bcrypt_hash_prepare(
+    bcrypt_state_t *state,
+    // WARNING: password have to be null terminated and password_end should be located AFTER it!
+    const uint8_t *password, const uint8_t * const password_end,
+    // "salt" here means prefix "$vm$cc$" + base64 encoded salt
+    const uint8_t *salt, const uint8_t * const salt_end
+) {
+    size_t password_len;
+
+    if (!bcrypt_full_parse_hash(salt, salt_end, &state->minor, &state->cost, state->raw_salt, state->raw_salt + STR_SIZE(state->raw_salt))) {
+        return false;
+    }
+    if (!bcrypt_password_length(state->minor, password, password_end, &password_len)) {
+        return false;
+    }
+    eksblowfish_setup(&state->lane, password, password_len, state->raw_salt, state->cost);
+
+    return true;
+}
+
+// step 5 (once the expensive loop is done): the raw ciphertext
+static void bcrypt_hash_ciphertext(bcrypt_state_t *state, uint8_t ciphertext[4 * BCRYPT_WORDS])
+{
+    uint32_t i, cdata[BCRYPT_WORDS];
+
+    eksblowfish_finalize(&state->lane, cdata);
+
+    for (i = 0; i < BCRYPT_WORDS; i++) {
+        ciphertext[4 * i + 3] = cdata[i] & 0xFF;
+        cdata[i] = cdata[i] >> 8;
+        ciphertext[4 * i + 2] = cdata[i] & 0xFF;
+        cdata[i] = cdata[i] >> 8;
+        ciphertext[4 * i + 1] = cdata[i] & 0xFF;
+        cdata[i] = cdata[i] >> 8;
+        ciphertext[4 * i + 0] = cdata[i] & 0xFF;
+    }
+    explicit_bzero(cdata, sizeof(cdata));
+}
+
+static uint8_t *bcrypt_hash_complete(bcrypt_state_t *state, uint8_t *hash, const uint8_t * const hash_end)
+{
+    uint8_t *w;
+    uint8_t ciphertext[4 * BCRYPT_WORDS];
+
+    bcrypt_hash_ciphertext(state, ciphertext);
+
+    do {
+        if (NULL == (w = write_prefix(hash, hash_end, state->minor, state->cost))) {
+            break; // ENCODING_FAIL
+        }
+        if (NULL == (w = encode_base64(state->raw_salt, state->raw_salt + STR_SIZE(state->raw_salt), w, hash_end))) {
+            break; // ENCODING_FAIL
+        }
+        // NOTE: only the first 23 bytes of the ciphertext are kept
+        if (NULL == (w = encode_base64(ciphertext, ciphertext + STR_LEN(ciphertext), w, hash_end))) {
+            break; // ENCODING_FAIL
+        }
+    } while (false);
+    explicit_bzero(ciphertext, sizeof(ciphertext));
+    explicit_bzero(state->raw_salt, sizeof(state->raw_salt));
+
+    return w;
+}
+
+static uint8_t *bcrypt_hash_builtin(
+    const uint8_t *password, const uint8_t * const password_end,
+    const uint8_t *salt, const uint8_t * const salt_end,
+    uint8_t *hash, const uint8_t * const hash_end
+) {
+    bcrypt_state_t state;
+    eksblowfish_lane_t *lanes[] = { &state.lane };
+
+    if (!bcrypt_hash_prepare(&state, password, password_end, salt, salt_end)) {
+        return NULL;
+    }
+    eksblowfish_expand_x1(lanes, ARRAY_SIZE(lanes));
+
+    return bcrypt_hash_complete(&state, hash, hash_end);
+}
+
+#ifdef HAVE_LIBXCRYPT
+// true if none of the *len* bytes of *password* is a \0 or has its 8th bit set
+static bool bcrypt_ascii(const uint8_t *password, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if ('\0' == password[i] || password[i] > 0x7F) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Same as bcrypt_hash_builtin but computed by crypt_rn from libxcrypt.
+ *
+ * crypt_rn takes the password as a C string: the ones which contain a \0
+ * (before the terminating one) and the ones which are longer than what
+ * the NIF accepts (where $2a$ differs from libxcrypt) are handed to the
+ * builtin implementation instead. So are all the $2a$ hashes and the
+ * passwords with 8-bit characters: libxcrypt applies the countermeasure
+ * of crypt_blowfish to the former and some of its builds do not handle
+ * the latter the way the NIF does.
+ */
+EXPORT_IF_STANDALONE uint8_t *bcrypt_hash_libxcrypt(
+    const uint8_t *password, const uint8_t * const password_end,
+    const uint8_t *salt, const uint8_t * const salt_end,
+    uint8_t *hash, const uint8_t * const hash_end
+) {
+    int minor, cost;
+    size_t password_len;
+    struct crypt_data data;
+    uint8_t raw_salt[BCRYPT_MAXSALT], key[BCRYPT_MAX_KEY_LEN + 1], setting[BCRYPT_SALTSPACE + 1];
+    uint8_t *w;
+
+    if (password > password_end) {
+        return NULL; // PWD_PTR_MISMATCH
+    }
+    password_len = password_end - password;
+    if (password_len > 0 && '\0' == password[password_len - 1]) {
+        --password_len;
+    }
+    if (!bcrypt_full_parse_hash(salt, salt_end, &minor, &cost, raw_salt, raw_salt + STR_SIZE(raw_salt))) {
+        return NULL;
+    }
+    if (password_len > BCRYPT_MAX_KEY_LEN || 'a' == minor || !bcrypt_ascii(password, password_len)) {
+        return bcrypt_hash_builtin(password, password_end, salt, salt_end, hash, hash_end);
+    }
+    if (hash > hash_end || ((size_t) (hash_end - hash)) < BCRYPT_HASHSPACE - 1) {
+        return NULL; // ENCODING_FAIL
+    }
+    memcpy(key, password, password_len);
+    key[password_len] = '\0';
+    memcpy(setting, salt, BCRYPT_SALTSPACE);
+    setting[BCRYPT_SALTSPACE] = '\0';
+    memset(&data, 0, sizeof(data));
+    w = NULL;
+    if (
+           NULL != crypt_rn((const char *) key, (const char *) setting, &data, sizeof(data))
+        && BCRYPT_HASHSPACE - 1 == strlen(data.output)
+    ) {
+        memcpy(hash, data.output, BCRYPT_HASHSPACE - 1);
+        w = hash + BCRYPT_HASHSPACE - 1;
+    }
+    explicit_bzero(&data, sizeof(data));
+    explicit_bzero(key, sizeof(key));
+
+    return w;
+}
+#endif /* HAVE_LIBXCRYPT */
+
+typedef uint8_t *(*bcrypt_hash_t)(const uint8_t *, const uint8_t * const, const uint8_t *, const uint8_t * const, uint8_t *, const uint8_t * const);
+
+/**
+ * The implementations of bcrypt_hash: the bundled one and, if found at
+ * build time, the one of libxcrypt. bcrypt_select_backend checks that
+ * the other ones give the same hashes than the bundled one then retains
+ * the fastest.
+ */
+typedef struct {
+    const char *name;
+    bcrypt_hash_t hash;
+    // measured throughput: hashes of cost BENCHMARK_COST per second (0 if not conformant)
+    double rate;
+} bcrypt_backend_t;
+
+static bcrypt_backend_t backends[] = {
+    { "builtin", bcrypt_hash_builtin, 0.0 },
+#ifdef HAVE_LIBXCRYPT
+    { "libxcrypt", bcrypt_hash_libxcrypt, 0.0 },
+#endif /* HAVE_LIBXCRYPT */
+};
+
+static const bcrypt_backend_t *backend = &backends[0];
+
+EXPORT_IF_STANDALONE uint8_t *bcrypt_hash(
+    // WARNING: password have to be null terminated and password_end should be located AFTER it!
+    const uint8_t *password, const uint8_t * const password_end,
+    // "salt" here means prefix "$vm$cc$" + base64 encoded salt
+    const uint8_t *salt, const uint8_t * const salt_end,
+    uint8_t *hash, const uint8_t * const hash_end
+) {
+    return backend->hash(password, password_end, salt, salt_end, hash, hash_end);
+}
+
+EXPORT_IF_STANDALONE const char *bcrypt_backend(void)
+{
+    return backend->name;
+}
+
+#define BENCHMARK_COST 4
+// minimum duration of the benchmark of a backend, in seconds
+#define BENCHMARK_DURATION 0.005
+
+// compares the hashes of the backend to the ones of the bundled implementation for each minor
+static bool bcrypt_backend_conformant(const bcrypt_backend_t *candidate)
+{
+    size_t j, k;
+    bool conformant;
+    const int minors[] = { 'a', 'b', 'y' };
+    const uint8_t raw_salt[BCRYPT_MAXSALT] = { 0x10, 0x41, 0x04, 0x10, 0x41, 0x04, 0x10, 0x41, 0x04, 0x10, 0x41, 0x04, 0x10, 0x41, 0x04, 0xFF };
+    const uint8_t *passwords[] = {
+        (const uint8_t *) "",
+        (const uint8_t *) "U*U",
+        (const uint8_t *) "\xA3\xFF\xA3\x80",
+        (const uint8_t *) "\xFF\xA3" "34" "\xFF\xFF\xFF\xA3" "345",
+        (const uint8_t *) "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789",
+    };
+
+    conformant = true;
+    for (j = 0; conformant && j < ARRAY_SIZE(minors); j++) {
+        uint8_t salt[BCRYPT_SALTSPACE];
+
+        if (NULL == bcrypt_init_salt(minors[j], BCRYPT_MINLOGROUNDS, raw_salt, raw_salt + STR_SIZE(raw_salt), salt, salt + STR_SIZE(salt))) {
+            return false;
+        }
+        for (k = 0; conformant && k < ARRAY_SIZE(passwords); k++) {
+            uint8_t *p, *q, expected[BCRYPT_HASHSPACE - 1], hash[BCRYPT_HASHSPACE - 1];
+            const uint8_t *password_end = passwords[k] + strlen((const char *) passwords[k]) + 1;
+
+            p = bcrypt_hash_builtin(passwords[k], password_end, salt, salt + STR_SIZE(salt), expected, expected + STR_SIZE(expected));
+            q = candidate->hash(passwords[k], password_end, salt, salt + STR_SIZE(salt), hash, hash + STR_SIZE(hash));
+            conformant = NULL != p && NULL != q && (p - expected) == (q - hash) && 0 == memcmp(expected, hash, p - expected);
+        }
+    }
+
+    return conformant;
+}
+
+static double bcrypt_backend_benchmark(const bcrypt_backend_t *candidate)
+{
+    size_t hashes;
+    double elapsed;
+    struct timespec start, now;
+    uint8_t salt[BCRYPT_SALTSPACE], hash[BCRYPT_HASHSPACE - 1];
+    const uint8_t password[] = "EksBlowfish", raw_salt[BCRYPT_MAXSALT] = { 0 };
+
+    if (NULL == bcrypt_init_salt(BCRYPT_MINOR, BENCHMARK_COST, raw_salt, raw_salt + STR_SIZE(raw_salt), salt, salt + STR_SIZE(salt))) {
+        return 0.0;
+    }
+    hashes = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+        if (NULL == candidate->hash(password, password + STR_SIZE(password), salt, salt + STR_SIZE(salt), hash, hash + STR_SIZE(hash))) {
+            return 0.0;
+        }
+        ++hashes;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        elapsed = (double) (now.tv_sec - start.tv_sec) + (double) (now.tv_nsec - start.tv_nsec) / 1e9;
+    } while (elapsed < BENCHMARK_DURATION);
+
+    return (double) hashes / elapsed;
+}
+
+EXPORT_IF_STANDALONE void bcrypt_select_backend(void)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(backends); i++) {
+        if (&backends[i] == &backends[0] || bcrypt_backend_conformant(&backends[i])) {
+            backends[i].rate = bcrypt_backend_benchmark(&backends[i]);
+            if (backends[i].rate > backend->rate) {
+                backend = &backends[i];
+            }
+        }
+    }
+}
+
+#ifdef STANDALONE
+/**
+ * The batches of the command line tool (bcrypt_cli.c): computes, with the
+ * selected kernel, the hash of each of the *count* passwords (which have
+ * to be null terminated) with the salt ("$vm$cc$" + base64 encoded salt,
+ * a full hash fits) of the same index. The hashes are written one after
+ * the other (BCRYPT_HASHSPACE - 1 bytes each) into *hashes* and
+ * computed[i] tells if the i-th was (its salt is valid).
+ */
+typedef struct {
+    bcrypt_state_t state;
+    // position of the job in the arrays
+    size_t index;
+} bcrypt_many_job_t;
+
+typedef struct {
+    const uint8_t * const *passwords;
+    const uint8_t * const *salts;
+    uint8_t *hashes;
+    bool *computed;
+    size_t count, read;
+    // one job per lane of the kernel, the ones not in a lane are stacked in *free*
+    size_t free_count;
+    bcrypt_many_job_t *free[EKSBLOWFISH_LANES_MAX];
+} bcrypt_many_t;
+
+static eksblowfish_lane_t *bcrypt_many_next(void *data)
+{
+    bcrypt_many_t *many = data;
+
+    while (many->read < many->count) {
+        const uint8_t *password;
+        bcrypt_many_job_t *job = many->free[many->free_count - 1];
+
+        job->index = many->read++;
+        password = many->passwords[job->index];
+        if (bcrypt_hash_prepare(&job->state, password, password + strlen((const char *) password) + 1, many->salts[job->index], many->salts[job->index] + BCRYPT_SALTSPACE)) {
+            --many->free_count;
+            return &job->state.lane;
+        }
+        many->computed[job->index] = false;
+    }
+
+    return NULL;
+}
+
+static void bcrypt_many_done(eksblowfish_lane_t *lane, void *data)
+{
+    bcrypt_many_t *many = data;
+    bcrypt_many_job_t *job = (bcrypt_many_job_t *) ((uint8_t *) lane - offsetof(bcrypt_many_job_t, state.lane));
+    uint8_t * const hash = many->hashes + job->index * (BCRYPT_HASHSPACE - 1);
+
+    many->computed[job->index] = NULL != bcrypt_hash_complete(&job->state, hash, hash + BCRYPT_HASHSPACE - 1);
+    many->free[many->free_count++] = job;
+}
+
+EXPORT_IF_STANDALONE bool bcrypt_hash_many(const uint8_t * const *passwords, const uint8_t * const *salts, uint8_t *hashes, bool *computed, size_t count)
+{
+    void *raw, *jobs;
+    size_t j, lanes;
+    bcrypt_many_t many = { passwords, salts, hashes, computed, count, 0, 0, { NULL } };
+
+    lanes = eksblowfish_kernel()->lanes;
+    if (NULL == (raw = malloc(lanes * sizeof(bcrypt_many_job_t) + BLF_ALIGNMENT - 1))) {
+        return false;
+    }
+    jobs = BLF_ALIGN(raw);
+    for (j = 0; j < lanes; j++) {
+        many.free[many.free_count++] = (bcrypt_many_job_t *) jobs + lanes - 1 - j;
+    }
+    eksblowfish_schedule(bcrypt_many_next, bcrypt_many_done, &many, NULL);
+    explicit_bzero(jobs, lanes * sizeof(bcrypt_many_job_t));
+    free(raw);
+
+    return true;
+}
+#endif /* STANDALONE */
+
+#ifndef STANDALONE
+/**
+ * Batches: the expensive loops of several independent hashes are run
+ * together by the selected kernel so all its lanes are kept busy.
+ *
+ * The lanes are fed by eksblowfish_schedule: each job is prepared
+ * (bcrypt_job_prepare*) from the next element of a list when a lane of
+ * the kernel gets free and its hash is completed as soon as its expensive
+ * loop is done, so a batch mixing several costs does not wait for its
+ * costliest hashes before refilling the lanes of the cheapest ones.
+ */
+typedef struct {
+    bcrypt_state_t state;
+    // set by bcrypt_job_prepare
+    bool prepared;
+    // set by bcrypt_batch_run: end of the hash written in *hash* or NULL on failure
+    uint8_t *hash_end;
+    uint8_t hash[BCRYPT_HASHSPACE - 1];
+    // position of the job in the input list
+    size_t index;
+    // the hash to compare the result to, for the NIFs which verify
+    ErlNifBinary reference;
+} bcrypt_job_t;
+
+static bool bcrypt_job_prepare(
+    bcrypt_job_t *job,
+    // WARNING: password have to be null terminated and password_end should be located AFTER it!
+    const uint8_t *password, const uint8_t * const password_end,
+    // "salt" here means prefix "$vm$cc$" + base64 encoded salt
+    const uint8_t *salt, const uint8_t * const salt_end
+) {
+    job->hash_end = NULL;
+    job->prepared = bcrypt_hash_prepare(&job->state, password, password_end, salt, salt_end);
+
+    return job->prepared;
+}
+
+/**
+ * Same as bcrypt_job_prepare with the key schedule of the password
+ * computed beforehand by eksblowfish_key_schedule (for a password checked
+ * against several hashes).
+ *
+ * NOTE: the NIFs truncate the passwords to BCRYPT_MAX_KEY_LEN bytes so
+ * bcrypt_password_length gives the same length for all the minors and a
+ * same schedule is valid whatever the version of the hash.
+ */
+static bool bcrypt_job_prepare_scheduled(
+    bcrypt_job_t *job,
+    const uint32_t password_key[BLF_N + 2],
+    const uint8_t *salt, const uint8_t * const salt_end
+) {
+    bcrypt_state_t *state = &job->state;
+
+    job->hash_end = NULL;
+    job->prepared = NULL != bcrypt_full_parse_hash(salt, salt_end, &state->minor, &state->cost, state->raw_salt, state->raw_salt + STR_SIZE(state->raw_salt));
+    if (job->prepared) {
+        memcpy(state->lane.password_key, password_key, sizeof(state->lane.password_key));
+        eksblowfish_setup_salt(&state->lane, state->raw_salt, state->cost);
+    }
+
+    return job->prepared;
+}
+
+/**
+ * Same as bcrypt_job_prepare for a hash already parsed (by
+ * bcrypt_full_parse_hash) into *parsed* (several passwords checked
+ * against the same hash).
+ */
+static bool bcrypt_job_prepare_parsed(
+    bcrypt_job_t *job,
+    const bcrypt_state_t *parsed,
+    // WARNING: password have to be null terminated and password_end should be located AFTER it!
+    const uint8_t *password, const uint8_t * const password_end
+) {
+    size_t password_len;
+    bcrypt_state_t *state = &job->state;
+
+    job->hash_end = NULL;
+    job->prepared = bcrypt_password_length(parsed->minor, password, password_end, &password_len);
+    if (job->prepared) {
+        state->minor = parsed->minor;
+        state->cost = parsed->cost;
+        memcpy(state->raw_salt, parsed->raw_salt, sizeof(state->raw_salt));
+        eksblowfish_setup(&state->lane, password, password_len, state->raw_salt, state->cost);
+    }
+
+    return job->prepared;
+}
+
+typedef struct bcrypt_batch_t bcrypt_batch_t;
+
+struct bcrypt_batch_t {
+    ErlNifEnv *env;
+    // the remaining elements of the input list
+    ERL_NIF_TERM tail;
+    // number of elements of the list and how many were read so far
+    size_t count, read;
+    // false if an element of the list was invalid
+    bool valid;
+    // set by *complete* to stop reading the list (the running jobs are still completed)
+    bool stop;
+    // checks *head* (an element of the list) before any hash of the batch is computed, returns false if it is invalid
+    bool (*check)(bcrypt_batch_t *, ERL_NIF_TERM);
+    // prepares *job* from *head* (an element of the list), returns false if it is invalid
+    bool (*prepare)(bcrypt_batch_t *, bcrypt_job_t *, ERL_NIF_TERM);
+    // handles the result of *job* (hash_end is NULL if the job could not be prepared or completed)
+    void (*complete)(bcrypt_batch_t *, bcrypt_job_t *);
+    // context of the NIF for prepare and complete
+    void *data;
+    // one job per lane of the kernel, the ones not in a lane are stacked in *free*
+    bcrypt_job_t *jobs;
+    size_t free_count;
+    bcrypt_job_t *free[EKSBLOWFISH_LANES_MAX];
+};
+
+// lanes utilization of the batches run since the NIF was loaded
+static ErlNifMutex *utilization_lock;
+// not const: enif_mutex_create takes a char *
+static char utilization_lock_name[] = "expassword_bcrypt_utilization";
+static eksblowfish_utilization_t utilization;
+
+static void bcrypt_batch_release(bcrypt_batch_t *batch, bcrypt_job_t *job)
+{
+    job->prepared = false;
+    batch->free[batch->free_count++] = job;
+}
+
+static eksblowfish_lane_t *bcrypt_batch_next(void *data)
+{
+    ERL_NIF_TERM head;
+    bcrypt_job_t *job;
+    bcrypt_batch_t *batch = data;
+
+    while (batch->valid && !batch->stop && batch->read < batch->count) {
+        // eksblowfish_schedule never asks for more lanes than the kernel has
+        assert(batch->free_count > 0);
+        job = batch->free[--batch->free_count];
+        job->index = batch->read++;
+        job->hash_end = NULL;
+        job->prepared = false;
+        enif_get_list_cell(batch->env, batch->tail, &head, &batch->tail);
+        if (!batch->prepare(batch, job, head)) {
+            batch->valid = false;
+            bcrypt_batch_release(batch, job);
+        } else if (job->prepared) {
+            return &job->state.lane;
+        } else {
+            // checked but could not be prepared: there is nothing to compute
+            batch->complete(batch, job);
+            bcrypt_batch_release(batch, job);
+        }
+    }
+
+    return NULL;
+}
+
+static void bcrypt_batch_done(eksblowfish_lane_t *lane, void *data)
+{
+    bcrypt_batch_t *batch = data;
+    bcrypt_job_t *job = (bcrypt_job_t *) ((uint8_t *) lane - offsetof(bcrypt_job_t, state.lane));
+
+    job->hash_end = bcrypt_hash_complete(&job->state, job->hash, job->hash + STR_SIZE(job->hash));
+    batch->complete(batch, job);
+    bcrypt_batch_release(batch, job);
+}
+
+/**
+ * Runs *check* on each of the *count* elements of *list* then, if they
+ * are all valid, *prepare* and *complete*. Returns false if an element
+ * was invalid or a job could not be allocated or prepared.
+ *
+ * All the elements are checked first so an invalid one is reported
+ * whatever its position (*complete* may stop the batch before reaching
+ * it) and before any hash is computed.
+ */
+static bool bcrypt_batch_run(bcrypt_batch_t *batch, ErlNifEnv *env, ERL_NIF_TERM list, size_t count)
+{
+    void *raw;
+    size_t j, lanes;
+    ERL_NIF_TERM head, tail;
+    eksblowfish_utilization_t used = { 0 };
+
+    batch->env = env;
+    for (tail = list, j = 0; j < count; j++) {
+        enif_get_list_cell(env, tail, &head, &tail);
+        if (!batch->check(batch, head)) {
+            return false;
+        }
+    }
+    lanes = eksblowfish_kernel()->lanes;
+    batch->tail = list;
+    batch->count = count;
+    batch->read = 0;
+    batch->valid = true;
+    batch->stop = false;
+    if (NULL == (raw = enif_alloc(lanes * sizeof(bcrypt_job_t) + BLF_ALIGNMENT - 1))) {
+        return false;
+    }
+    batch->jobs = BLF_ALIGN(raw);
+    for (batch->free_count = j = 0; j < lanes; j++) {
+        bcrypt_batch_release(batch, &batch->jobs[lanes - 1 - j]);
+    }
+    eksblowfish_schedule(bcrypt_batch_next, bcrypt_batch_done, batch, &used);
+    explicit_bzero(batch->jobs, lanes * sizeof(bcrypt_job_t));
+    enif_free(raw);
+
+    enif_mutex_lock(utilization_lock);
+    utilization.lanes = used.lanes;
+    utilization.elapsed += used.elapsed;
+    for (j = 0; j < used.lanes; j++) {
+        utilization.busy[j] += used.busy[j];
+    }
+    enif_mutex_unlock(utilization_lock);
+
+    return batch->valid;
+}
+
+static bool bcrypt_job_matches(const bcrypt_job_t *job, const ErlNifBinary *goodhash)
+{
+    return
+           NULL != job->hash_end
+        && goodhash->size == ((size_t) (job->hash_end - job->hash))
+        && 0 == timingsafe_bcmp(goodhash->data, job->hash, STR_SIZE(job->hash))
+    ;
+}
+
+/**
+ * Single-flight: identical verifications (same password against the same
+ * hash) submitted concurrently are computed once, the late callers get
+ * the result of the one which is already running instead of burning
+ * another computation (retries, credential stuffing, ...).
+ *
+ * The late callers do not wait on a dirty scheduler: they are parked on
+ * the flight (their pid and a reference) and return {:wait, ref} right
+ * away, the caller computing the verification sends each of them
+ * {:bcrypt_verified, ref, result} once it is done. A flight takes at most
+ * BCRYPT_FLIGHT_WAITERS_MAX of them, the next ones compute the
+ * verification again.
+ *
+ * The password is never kept: the in-flight verifications are identified
+ * by SipHash, keyed by a secret drawn when the NIF is loaded, of the hash
+ * followed by the password. The hash is also compared in full.
+ */
+#define BCRYPT_FLIGHTS_MAX 64
+#define BCRYPT_FLIGHT_WAITERS_MAX 32
+
+typedef struct {
+    ErlNifPid pid;
+    // holds *ref*, the reference returned to the caller, then the message sent to it
+    ErlNifEnv *env;
+    ERL_NIF_TERM ref;
+} bcrypt_flight_waiter_t;
+
+typedef struct {
+    // true while the verification is computed (false if the slot is free)
+    bool busy;
+    uint8_t key[SIPHASH_128_SIZE];
+    uint8_t hash[BCRYPT_HASHSPACE - 1];
+    // the callers parked until the verification is done
+    size_t waiting;
+    bcrypt_flight_waiter_t waiters[BCRYPT_FLIGHT_WAITERS_MAX];
+} bcrypt_flight_t;
+
+typedef enum {
+    BCRYPT_FLIGHT_MISMATCH,
+    BCRYPT_FLIGHT_MATCH,
+    // the caller was parked on an identical verification in flight
+    BCRYPT_FLIGHT_PARKED,
+} bcrypt_flight_result_t;
+
+static struct {
+    ErlNifMutex *lock;
+    uint8_t secret[SIPHASH_KEY_SIZE];
+    // number of verifications actually computed and of the ones which reused the result of another
+    uint64_t computed, saved;
+    bcrypt_flight_t flights[BCRYPT_FLIGHTS_MAX];
+} single_flight;
+// not const: enif_mutex_create takes a char *
+static char single_flight_name[] = "expassword_bcrypt_single_flight";
+
+static bool bcrypt_verify(const uint8_t *password0, const uint8_t * const password0_end, const ErlNifBinary *goodhash)
+{
+    uint8_t *p, hash[BCRYPT_HASHSPACE - 1];
+
+    p = bcrypt_hash(password0, password0_end, goodhash->data, goodhash->data + goodhash->size, hash, hash + STR_SIZE(hash));
+
+    return NULL != p && p > hash && goodhash->size == ((size_t) (p - hash)) && 0 == timingsafe_bcmp(goodhash->data, hash, STR_SIZE(hash));
+}
+
+/**
+ * Same as bcrypt_verify but, if an identical verification is in flight,
+ * parks the caller on it: *ref* is then set to the reference of the
+ * message the caller will receive (*goodhash* has to be checked by
+ * bcrypt_valid_hash first). The callers which cannot be parked (*ref* is
+ * NULL) compute the verification themselves.
+ */
+static bcrypt_flight_result_t bcrypt_verify_single_flight(ErlNifEnv *env, const uint8_t *password0, const uint8_t * const password0_end, const ErlNifBinary *goodhash, ERL_NIF_TERM *ref)
+{
+    bool result;
+    size_t i, waiting;
+    ErlNifEnv *waiter_env;
+    bcrypt_flight_t *flight, *slot;
+    bcrypt_flight_result_t output;
+    bcrypt_flight_waiter_t waiters[BCRYPT_FLIGHT_WAITERS_MAX];
+    uint8_t key[SIPHASH_128_SIZE], input[(BCRYPT_HASHSPACE - 1) + BCRYPT_MAX_KEY_LEN];
+
+    assert(STR_SIZE(flight->hash) == goodhash->size);
+    memcpy(input, goodhash->data, goodhash->size);
+    memcpy(input + goodhash->size, password0, password0_end - password0);
+    siphash128(single_flight.secret, input, goodhash->size + (password0_end - password0), key);
+    explicit_bzero(input, sizeof(input));
+
+    slot = flight = NULL;
+    enif_mutex_lock(single_flight.lock);
+    for (i = 0; NULL == flight && i < ARRAY_SIZE(single_flight.flights); i++) {
+        bcrypt_flight_t *candidate = &single_flight.flights[i];
+
+        if (!candidate->busy) {
+            if (NULL == slot) {
+                slot = candidate;
+            }
+        } else if (
+               0 == memcmp(candidate->hash, goodhash->data, STR_SIZE(candidate->hash))
+            && 0 == timingsafe_bcmp(candidate->key, key, STR_SIZE(key))
+        ) {
+            flight = candidate;
+        }
+    }
+    output = BCRYPT_FLIGHT_MISMATCH;
+    if (NULL != flight) {
+        // a full flight or a caller which needs the result in this call: the verification is computed again, without being shared
+        if (
+               NULL != ref
+            && flight->waiting < ARRAY_SIZE(flight->waiters)
+            && NULL != (waiter_env = enif_alloc_env())
+        ) {
+            bcrypt_flight_waiter_t *waiter = &flight->waiters[flight->waiting++];
+
+            *ref = enif_make_ref(env);
+            waiter->env = waiter_env;
+            waiter->ref = enif_make_copy(waiter_env, *ref);
+            enif_self(env, &waiter->pid);
+            output = BCRYPT_FLIGHT_PARKED;
+        }
+        flight = NULL;
+    } else if (NULL != (flight = slot)) {
+        // when all the slots are taken, the verification is just computed without being shared
+        flight->busy = true;
+        flight->waiting = 0;
+        memcpy(flight->key, key, STR_SIZE(key));
+        memcpy(flight->hash, goodhash->data, STR_SIZE(flight->hash));
+    }
+    if (BCRYPT_FLIGHT_PARKED == output) {
+        ++single_flight.saved;
+    } else {
+        ++single_flight.computed;
+    }
+    enif_mutex_unlock(single_flight.lock);
+    explicit_bzero(key, sizeof(key));
+
+    if (BCRYPT_FLIGHT_PARKED != output) {
+        result = bcrypt_verify(password0, password0_end, goodhash);
+        output = result ? BCRYPT_FLIGHT_MATCH : BCRYPT_FLIGHT_MISMATCH;
+        if (NULL != flight) {
+            // the slot is freed before the messages are sent so the lock is not held meanwhile
+            enif_mutex_lock(single_flight.lock);
+            waiting = flight->waiting;
+            memcpy(waiters, flight->waiters, waiting * sizeof(*waiters));
+            explicit_bzero(flight, sizeof(*flight));
+            enif_mutex_unlock(single_flight.lock);
+            for (i = 0; i < waiting; i++) {
+                enif_send(env, &waiters[i].pid, waiters[i].env, enif_make_tuple3(waiters[i].env, atom_bcrypt_verified, waiters[i].ref, result ? atom_true : atom_false));
+                enif_free_env(waiters[i].env);
+            }
+        }
+    }
+
+    return output;
+}
+
+// fills *buffer* from the CSPRNG of the system (getentropy is limited to 256 bytes per call)
+static bool bcrypt_random_bytes(uint8_t *buffer, size_t length)
+{
+    size_t chunk;
+
+    for (/* NOP */; length > 0; buffer += chunk, length -= chunk) {
+        chunk = length > 256 ? 256 : length;
+        if (0 != getentropy(buffer, chunk)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Per thread reserve of random bytes for the salts, so hashing a password
+ * does not cost a system call: it is refilled from the CSPRNG of the
+ * system (getentropy) when exhausted and the bytes are wiped once handed
+ * out.
+ */
+static __thread struct {
+    size_t available;
+    uint8_t bytes[256];
+} entropy;
+
+static bool bcrypt_random_salt(uint8_t raw_salt[BCRYPT_MAXSALT])
+{
+    if (entropy.available < BCRYPT_MAXSALT) {
+        if (!bcrypt_random_bytes(entropy.bytes, STR_SIZE(entropy.bytes))) {
+            return false;
+        }
+        entropy.available = STR_SIZE(entropy.bytes);
+    }
+    entropy.available -= BCRYPT_MAXSALT;
+    memcpy(raw_salt, entropy.bytes + entropy.available, BCRYPT_MAXSALT);
+    explicit_bzero(entropy.bytes + entropy.available, BCRYPT_MAXSALT);
+
+    return true;
+}
+
+static bool c_string_to_erlang_binary(ErlNifEnv *env, ERL_NIF_TERM *output, const uint8_t * const data, size_t data_len)
+{
+    unsigned char *buffer;
+
+    assert(NULL != data);
+    if (NULL == (buffer = enif_make_new_binary(env, data_len, output))) {
+        *output = enif_make_badarg(env); // TODO: something better/more explicit?
+    } else {
+        memcpy(buffer, data, data_len);
+    }
+
+    return NULL != buffer;
+}
+
+/**
+ * Background rehashing: verify_and_upgrade_async_nif only verifies the
+ * password and, when the hash has to be upgraded, hands a copy of the
+ * password to a single thread which computes the new hash then sends it
+ * to the caller as {:bcrypt_rehashed, ref, new_hash}.
+ *
+ * It is bounded: at most BCRYPT_REHASH_QUEUE_MAX upgrades wait (the
+ * others are not scheduled, {:ok, :deferred} is returned instead of a
+ * ref and the hash will be upgraded at a next login)
+ * and, where SCHED_IDLE is available, the thread only gets the CPU time
+ * left unused by everything else, the foreground verifications included.
+ */
+#define BCRYPT_REHASH_QUEUE_MAX 32
+
+typedef struct {
+    // holds *ref*, sent along with the result
+    ErlNifEnv *env;
+    ErlNifPid pid;
+    ERL_NIF_TERM ref;
+    int cost;
+    size_t password0_len;
+    uint8_t password0[BCRYPT_MAX_KEY_LEN];
+} bcrypt_rehash_t;
+
+static struct {
+    ErlNifMutex *lock;
+    // signaled when a rehash is queued or the thread has to stop
+    ErlNifCond *cond;
+    ErlNifTid thread;
+    bool stop;
+    size_t head, count;
+    bcrypt_rehash_t queue[BCRYPT_REHASH_QUEUE_MAX];
+} rehash;
+// not const: enif_mutex_create, enif_cond_create and enif_thread_create take a char *
+static char rehash_name[] = "expassword_bcrypt_rehash";
+
+static void bcrypt_rehash_run(bcrypt_rehash_t *job)
+{
+    ERL_NIF_TERM new_hash;
+    uint8_t raw_salt[BCRYPT_MAXSALT], salt[BCRYPT_SALTSPACE], hash[BCRYPT_HASHSPACE - 1];
+
+    if (
+           bcrypt_random_salt(raw_salt)
+        && NULL != bcrypt_init_salt(BCRYPT_MINOR, job->cost, raw_salt, raw_salt + STR_SIZE(raw_salt), salt, salt + STR_SIZE(salt))
+        && NULL != bcrypt_hash(job->password0, job->password0 + job->password0_len, salt, salt + STR_SIZE(salt), hash, hash + STR_SIZE(hash))
+        && c_string_to_erlang_binary(job->env, &new_hash, hash, STR_SIZE(hash))
+    ) {
+        enif_send(NULL, &job->pid, job->env, enif_make_tuple3(job->env, atom_bcrypt_rehashed, job->ref, new_hash));
+    }
+    explicit_bzero(raw_salt, sizeof(raw_salt));
+}
+
+static void *bcrypt_rehash_thread(void *UNUSED(arg))
+{
+    bcrypt_rehash_t job;
+#ifdef HAVE_SCHED_IDLE
+    struct sched_param param = { .sched_priority = 0 };
+
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif /* HAVE_SCHED_IDLE */
+
+    enif_mutex_lock(rehash.lock);
+    for (;;) {
+        while (0 == rehash.count && !rehash.stop) {
+            enif_cond_wait(rehash.cond, rehash.lock);
+        }
+        if (rehash.stop) {
+            break;
+        }
+        job = rehash.queue[rehash.head];
+        explicit_bzero(&rehash.queue[rehash.head], sizeof(rehash.queue[rehash.head]));
+        rehash.head = (rehash.head + 1) % ARRAY_SIZE(rehash.queue);
+        --rehash.count;
+        enif_mutex_unlock(rehash.lock);
+        bcrypt_rehash_run(&job);
+        enif_free_env(job.env);
+        explicit_bzero(&job, sizeof(job));
+        enif_mutex_lock(rehash.lock);
+    }
+    enif_mutex_unlock(rehash.lock);
+
+    return NULL;
+}
+
+/**
+ * Queues the rehash of *password0* (as copied by memcpy_l) with *cost*
+ * for the calling process. Returns false, without scheduling anything,
+ * if the queue is full.
+ */
+static bool bcrypt_rehash_enqueue(ErlNifEnv *env, const uint8_t *password0, const uint8_t * const password0_end, int cost, ERL_NIF_TERM *ref)
+{
+    bool queued;
+
+    enif_mutex_lock(rehash.lock);
+    if ((queued = rehash.count < ARRAY_SIZE(rehash.queue))) {
+        bcrypt_rehash_t *job = &rehash.queue[(rehash.head + rehash.count) % ARRAY_SIZE(rehash.queue)];
+
+        *ref = enif_make_ref(env);
+        job->env = enif_alloc_env();
+        job->ref = enif_make_copy(job->env, *ref);
+        enif_self(env, &job->pid);
+        job->cost = cost;
+        job->password0_len = password0_end - password0;
+        memcpy(job->password0, password0, job->password0_len);
+        ++rehash.count;
+        enif_cond_signal(rehash.cond);
+    }
+    enif_mutex_unlock(rehash.lock);
+
+    return queued;
+}
+
+static ERL_NIF_TERM expassword_bcrypt_generate_salt_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
+{
+    int cost;
+    ERL_NIF_TERM output;
+    ErlNifBinary raw_salt;
+
+    if (
+           2 == argc
+        && enif_inspect_binary(env, argv[0], &raw_salt)
+        && enif_is_map(env, argv[1])
+        && extract_options_from_erlang_map(env, argv[1], &cost)
+    ) {
+        uint8_t salt[BCRYPT_SALTSPACE];
+
+        if (NULL == bcrypt_init_salt(BCRYPT_MINOR, cost, raw_salt.data, raw_salt.data + raw_salt.size, salt, salt + STR_SIZE(salt))) {
+            output = enif_make_badarg(env);
+        } else {
+            c_string_to_erlang_binary(env, &output, salt, STR_SIZE(salt));
+        }
+    } else {
+        output = enif_make_badarg(env);
+    }
+
+    return output;
+}
+
+static uint8_t *memcpy_l(const uint8_t *from, const uint8_t * const from_end, uint8_t *to, const uint8_t * const to_end)
+{
+    while (to < to_end && from < from_end) {
+        *to++ = *from++;
+    }
+    if (to < to_end) {
+      *to++ = '\0';
+    }
+
+    return to;
+}
+
+static ERL_NIF_TERM expassword_bcrypt_hash_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
+{
+    ERL_NIF_TERM output;
+    ErlNifBinary password, salt;
+
+    if (
+           2 == argc
+        && enif_inspect_binary(env, argv[0], &password)
+        && enif_inspect_binary(env, argv[1], &salt)
+    ) {
+        uint8_t hash[BCRYPT_HASHSPACE - 1], password0[BCRYPT_MAX_KEY_LEN], *password0_end;
+
+        password0_end = memcpy_l(password.data, password.data + password.size, password0, password0 + STR_SIZE(password0));
+        if (NULL != bcrypt_hash(password0, password0_end, salt.data, salt.data + salt.size, hash, hash + STR_SIZE(hash))) {
+            c_string_to_erlang_binary(env, &output, hash, STR_SIZE(hash));
+        } else {
+            output = enif_make_badarg(env);
+        }
+//         explicit_bzero(hash, sizeof(hash));
+        explicit_bzero(password0, sizeof(password0));
+    } else {
+        output = enif_make_badarg(env);
+    }
+
+    return output;
+}
+
+static ERL_NIF_TERM expassword_bcrypt_hash_password_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
+{
+    int cost;
+    ERL_NIF_TERM output;
+    ErlNifBinary password;
+
+    if (
+           2 == argc
+        && enif_inspect_binary(env, argv[0], &password)
+        && enif_is_map(env, argv[1])
+        && extract_options_from_erlang_map(env, argv[1], &cost)
+    ) {
+        uint8_t raw_salt[BCRYPT_MAXSALT], salt[BCRYPT_SALTSPACE], hash[BCRYPT_HASHSPACE - 1], password0[BCRYPT_MAX_KEY_LEN], *password0_end;
+
+        password0_end = memcpy_l(password.data, password.data + password.size, password0, password0 + STR_SIZE(password0));
+        if (
+               bcrypt_random_salt(raw_salt)
+            && NULL != bcrypt_init_salt(BCRYPT_MINOR, cost, raw_salt, raw_salt + STR_SIZE(raw_salt), salt, salt + STR_SIZE(salt))
+            && NULL != bcrypt_hash(password0, password0_end, salt, salt + STR_SIZE(salt), hash, hash + STR_SIZE(hash))
+        ) {
+            c_string_to_erlang_binary(env, &output, hash, STR_SIZE(hash));
+        } else {
+            output = enif_make_badarg(env);
+        }
+        explicit_bzero(raw_salt, sizeof(raw_salt));
+        explicit_bzero(password0, sizeof(password0));
+    } else {
+        output = enif_make_badarg(env);
+    }
+
+    return output;
+}
+
+static ERL_NIF_TERM expassword_bcrypt_verify_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
+{
+    ERL_NIF_TERM ref, output;
+    ErlNifBinary password, goodhash;
+    bcrypt_flight_result_t result;
+
+    if (
+           2 == argc
+        && enif_inspect_binary(env, argv[0], &password)
+        && enif_inspect_binary(env, argv[1], &goodhash)
+        && bcrypt_valid_hash(&goodhash)
+    ) {
+        uint8_t password0[BCRYPT_MAX_KEY_LEN], *password0_end;
+
+        password0_end = memcpy_l(password.data, password.data + password.size, password0, password0 + STR_SIZE(password0));
+        result = bcrypt_verify_single_flight(env, password0, password0_end, &goodhash, &ref);
+        if (BCRYPT_FLIGHT_PARKED == result) {
+            output = enif_make_tuple2(env, atom_wait, ref);
+        } else {
+            output = BCRYPT_FLIGHT_MATCH == result ? atom_true : atom_false;
+        }
+        explicit_bzero(password0, sizeof(password0));
+    } else {
+        output = enif_make_badarg(env);
+    }
+
+    return output;
+}
+
+static ERL_NIF_TERM expassword_bcrypt_verify_and_upgrade_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
+{
+    ERL_NIF_TERM output;
+    int old_cost, new_cost;
+    ErlNifBinary password, goodhash;
+
+    if (
+           3 == argc
+        && enif_inspect_binary(env, argv[0], &password)
+        && enif_inspect_binary(env, argv[1], &goodhash)
+        && enif_is_map(env, argv[2])
+        && extract_options_from_erlang_map(env, argv[2], &new_cost)
+        && bcrypt_valid_hash(&goodhash)
+        && bcrypt_parse_hash(&goodhash, &old_cost)
+    ) {
+        uint8_t password0[BCRYPT_MAX_KEY_LEN], *password0_end;
+
+        password0_end = memcpy_l(password.data, password.data + password.size, password0, password0 + STR_SIZE(password0));
+        if (BCRYPT_FLIGHT_MATCH != bcrypt_verify_single_flight(env, password0, password0_end, &goodhash, NULL)) {
+            output = atom_error;
+        } else if (old_cost == new_cost) {
+            output = enif_make_tuple2(env, atom_ok, atom_nil);
+        } else {
+            // same as needs_rehash? then hash/2 but in the same dirty job, the password is already at hand
+            uint8_t raw_salt[BCRYPT_MAXSALT], salt[BCRYPT_SALTSPACE], hash[BCRYPT_HASHSPACE - 1];
+
+            if (
+                   bcrypt_random_salt(raw_salt)
+                && NULL != bcrypt_init_salt(BCRYPT_MINOR, new_cost, raw_salt, raw_salt + STR_SIZE(raw_salt), salt, salt + STR_SIZE(salt))
+                && NULL != bcrypt_hash(password0, password0_end, salt, salt + STR_SIZE(salt), hash, hash + STR_SIZE(hash))
+                && c_string_to_erlang_binary(env, &output, hash, STR_SIZE(hash))
+            ) {
+                output = enif_make_tuple2(env, atom_ok, output);
+            } else {
+                output = enif_make_badarg(env);
+            }
+            explicit_bzero(raw_salt, sizeof(raw_salt));
+        }
+        explicit_bzero(password0, sizeof(password0));
+    } else {
+        output = enif_make_badarg(env);
+    }
+
+    return output;
+}
+
+static ERL_NIF_TERM expassword_bcrypt_verify_and_upgrade_async_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
+{
+    ERL_NIF_TERM ref, output;
+    int old_cost, new_cost;
+    ErlNifBinary password, goodhash;
+
+    if (
+           3 == argc
+        && enif_inspect_binary(env, argv[0], &password)
+        && enif_inspect_binary(env, argv[1], &goodhash)
+        && enif_is_map(env, argv[2])
+        && extract_options_from_erlang_map(env, argv[2], &new_cost)
+        && bcrypt_valid_hash(&goodhash)
+        && bcrypt_parse_hash(&goodhash, &old_cost)
+    ) {
+        uint8_t password0[BCRYPT_MAX_KEY_LEN], *password0_end;
+
+        password0_end = memcpy_l(password.data, password.data + password.size, password0, password0 + STR_SIZE(password0));
+        if (BCRYPT_FLIGHT_MATCH != bcrypt_verify_single_flight(env, password0, password0_end, &goodhash, NULL)) {
+            output = atom_error;
+        } else if (old_cost != new_cost) {
+            output = enif_make_tuple2(env, atom_ok, bcrypt_rehash_enqueue(env, password0, password0_end, new_cost, &ref) ? ref : atom_deferred);
+        } else {
+            output = enif_make_tuple2(env, atom_ok, atom_nil);
+        }
+        explicit_bzero(password0, sizeof(password0));
+    } else {
+        output = enif_make_badarg(env);
+    }
+
+    return output;
+}
+
+/**
+ * Pre-parsed hashes: parse_hash_nif decodes a hash once into a resource
+ * (its minor, cost, raw salt and the raw bytes of its digest) so it can
+ * be verified (or inspected) repeatedly without validating and decoding
+ * the hash again nor encoding the result to compare it.
+ */
+typedef struct {
+    int minor, cost;
+    uint8_t raw_salt[BCRYPT_MAXSALT];
+    // NOTE: only the first 23 bytes of the ciphertext are kept in a hash
+    uint8_t digest[4 * BCRYPT_WORDS - 1];
+} bcrypt_parsed_hash_t;
+
+static ErlNifResourceType *parsed_hash_type;
+
+static void bcrypt_parsed_hash_dtor(ErlNifEnv *UNUSED(env), void *obj)
+{
+    explicit_bzero(obj, sizeof(bcrypt_parsed_hash_t));
+}
+
+/**
+ * Decodes *hash* (which has to be checked by bcrypt_valid_hash first)
+ * into *parsed*. The encoding has to be canonical (the one bcrypt_hash
+ * would produce) else verify_nif would never match it.
+ */
+static bool bcrypt_parse_hash_raw(const ErlNifBinary *hash, bcrypt_parsed_hash_t *parsed)
+{
+    uint8_t *w, encoded[BCRYPT_HASHSPACE - 1];
+
+    if (
+           NULL == bcrypt_full_parse_hash(hash->data, hash->data + hash->size, &parsed->minor, &parsed->cost, parsed->raw_salt, parsed->raw_salt + STR_SIZE(parsed->raw_salt))
+        || NULL == decode_base64(hash->data + BCRYPT_SALTSPACE, hash->data + hash->size, parsed->digest, parsed->digest + STR_SIZE(parsed->digest))
+        || NULL == (w = write_prefix(encoded, encoded + STR_SIZE(encoded), parsed->minor, parsed->cost))
+        || NULL == (w = encode_base64(parsed->raw_salt, parsed->raw_salt + STR_SIZE(parsed->raw_salt), w, encoded + STR_SIZE(encoded)))
+        || NULL == (w = encode_base64(parsed->digest, parsed->digest + STR_SIZE(parsed->digest), w, encoded + STR_SIZE(encoded)))
+    ) {
+        return false;
+    }
+
+    return hash->size == ((size_t) (w - encoded)) && 0 == memcmp(hash->data, encoded, hash->size);
+}
+
+static ERL_NIF_TERM expassword_bcrypt_parse_hash_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
+{
+    ErlNifBinary hash;
+    ERL_NIF_TERM output;
+
+    if (1 != argc || !enif_inspect_binary(env, argv[0], &hash)) {
+        output = enif_make_badarg(env);
+    } else {
+        bcrypt_parsed_hash_t *parsed;
+
+        if (NULL == (parsed = enif_alloc_resource(parsed_hash_type, sizeof(*parsed)))) {
+            output = enif_make_badarg(env);
+        } else {
+            if (bcrypt_valid_hash(&hash) && bcrypt_parse_hash_raw(&hash, parsed)) {
+                output = enif_make_tuple2(env, atom_ok, enif_make_resource(env, parsed));
+            } else {
+                output = enif_make_tuple2(env, atom_error, atom_invalid);
+            }
+            // the term (if any) keeps the resource alive
+            enif_release_resource(parsed);
+        }
+    }
+
+    return output;
+}
+
+static ERL_NIF_TERM expassword_bcrypt_verify_parsed_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
+{
+    ERL_NIF_TERM output;
+    ErlNifBinary password;
+    bcrypt_parsed_hash_t *parsed;
+
+    if (
+           2 == argc
+        && enif_inspect_binary(env, argv[0], &password)
+        && enif_get_resource(env, argv[1], parsed_hash_type, (void **) &parsed)
+    ) {
+        size_t password_len;
+        bcrypt_state_t state;
+        eksblowfish_lane_t *lanes[] = { &state.lane };
+        uint8_t ciphertext[4 * BCRYPT_WORDS], password0[BCRYPT_MAX_KEY_LEN], *password0_end;
+
+        output = atom_false;
+        password0_end = memcpy_l(password.data, password.data + password.size, password0, password0 + STR_SIZE(password0));
+        if (bcrypt_password_length(parsed->minor, password0, password0_end, &password_len)) {
+            eksblowfish_setup(&state.lane, password0, password_len, parsed->raw_salt, parsed->cost);
+            eksblowfish_expand_x1(lanes, ARRAY_SIZE(lanes));
+            bcrypt_hash_ciphertext(&state, ciphertext);
+            // the raw digests are compared: no base64 involved
+            if (0 == timingsafe_bcmp(parsed->digest, ciphertext, STR_SIZE(parsed->digest))) {
+                output = atom_true;
+            }
+            explicit_bzero(ciphertext, sizeof(ciphertext));
+            explicit_bzero(&state, sizeof(state));
+        }
+        explicit_bzero(password0, sizeof(password0));
+    } else {
+        output = enif_make_badarg(env);
+    }
+
+    return output;
+}
+
+// true if *term* is a binary holding a hash which can be fully parsed
+static bool bcrypt_batch_check_hash(ErlNifEnv *env, ERL_NIF_TERM term)
+{
+    int minor, cost;
+    ErlNifBinary hash;
+    uint8_t raw_salt[BCRYPT_MAXSALT];
+
+    return
+           enif_inspect_binary(env, term, &hash)
+        && bcrypt_valid_hash(&hash)
+        && NULL != bcrypt_full_parse_hash(hash.data, hash.data + hash.size, &minor, &cost, raw_salt, raw_salt + STR_SIZE(raw_salt))
+    ;
+}
+
+// true if *term* is a binary, for the lists of passwords
+static bool bcrypt_batch_check_binary(bcrypt_batch_t *batch, ERL_NIF_TERM term)
+{
+    return enif_is_binary(batch->env, term);
+}
+
+static bool bcrypt_verify_many_check(bcrypt_batch_t *batch, ERL_NIF_TERM head)
+{
+    int arity;
+    const ERL_NIF_TERM *pair;
+
+    return
+           enif_get_tuple(batch->env, head, &arity, &pair)
+        && 2 == arity
+        && enif_is_binary(batch->env, pair[0])
+        && bcrypt_batch_check_hash(batch->env, pair[1])
+    ;
+}
+
+static bool bcrypt_verify_many_prepare(bcrypt_batch_t *batch, bcrypt_job_t *job, ERL_NIF_TERM head)
+{
+    int arity;
+    const ERL_NIF_TERM *pair;
+    ErlNifBinary password;
+
+    if (
+           enif_get_tuple(batch->env, head, &arity, &pair)
+        && 2 == arity
+        && enif_inspect_binary(batch->env, pair[0], &password)
+        && enif_inspect_binary(batch->env, pair[1], &job->reference)
+        && bcrypt_valid_hash(&job->reference)
+    ) {
+        uint8_t password0[BCRYPT_MAX_KEY_LEN], *password0_end;
+
+        password0_end = memcpy_l(password.data, password.data + password.size, password0, password0 + STR_SIZE(password0));
+        bcrypt_job_prepare(job, password0, password0_end, job->reference.data, job->reference.data + job->reference.size);
+        explicit_bzero(password0, sizeof(password0));
+
+        return true;
+    }
+
+    return false;
+}
+
+static void bcrypt_verify_many_complete(bcrypt_batch_t *batch, bcrypt_job_t *job)
+{
+    ERL_NIF_TERM *results = batch->data;
+
+    results[job->index] = bcrypt_job_matches(job, &job->reference) ? atom_true : atom_false;
 }
-#endif /* !STANDALONE */
 
-EXPORT_IF_STANDALONE uint8_t *bcrypt_hash(
-    // WARNING: password have to be null terminated and password_end should be located AFTER it!
-    const uint8_t *password, const uint8_t * const password_end,
-    // "salt" here means prefix "$vm$cc$" + base64 encoded salt
-    const uint8_t *salt, const uint8_t * const salt_end,
-    uint8_t *hash, const uint8_t * const hash_end
-) {
-    uint16_t j;
-    blf_ctx state;
-    int cost, minor;
-    size_t password_len;
-    uint32_t i, k, rounds, cdata[BCRYPT_WORDS];
-    uint8_t *w, raw_salt[BCRYPT_MAXSALT], ciphertext[4 * BCRYPT_WORDS] = "OrpheanBeholderScryDoubt";
-    const uint8_t * const raw_salt_end = raw_salt + STR_SIZE(raw_salt);
+static ERL_NIF_TERM expassword_bcrypt_verify_many_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
+{
+    unsigned int count;
+    ERL_NIF_TERM output;
 
-    if (!bcrypt_full_parse_hash(salt, salt_end, &minor, &cost, raw_salt, raw_salt_end)) {
-        return NULL;
-    }
-    if (password > password_end) {
-        return NULL; // PWD_PTR_MISMATCH
-    }
-    // REMINDER: password_len counts \0
-    password_len = (password_end - password);
-    if ('a' == minor) {
-        password_len = (uint8_t) (password_len);
-    } else if ('b' == minor || 'y' == minor) {
-        if (password_len > 73) {
-            password_len = 73;
+    if (1 == argc && enif_get_list_length(env, argv[0], &count)) {
+        bcrypt_batch_t batch;
+        ERL_NIF_TERM *results;
+
+        results = NULL;
+        if (count > 0 && NULL == (results = enif_alloc(count * sizeof(*results)))) {
+            output = enif_make_badarg(env);
+        } else {
+            batch.check = bcrypt_verify_many_check;
+            batch.prepare = bcrypt_verify_many_prepare;
+            batch.complete = bcrypt_verify_many_complete;
+            batch.data = results;
+            output = bcrypt_batch_run(&batch, env, argv[0], count) ? enif_make_list_from_array(env, results, count) : enif_make_badarg(env);
+        }
+        if (NULL != results) {
+            enif_free(results);
         }
     } else {
-        assert(false);
-        return NULL; // INCORRECT_TYPE
-    }
-
-    rounds = UINT32_C(1) << cost;
-    Blowfish_initstate(&state);
-    Blowfish_expandstate(&state, raw_salt, BCRYPT_MAXSALT, password, password_len);
-    for (k = 0; k < rounds; k++) {
-        Blowfish_expand0state(&state, password, password_len);
-        Blowfish_expand0state(&state, raw_salt, BCRYPT_MAXSALT);
+        output = enif_make_badarg(env);
     }
 
-    /* This can be precomputed later */
-    j = 0;
-    for (i = 0; i < BCRYPT_WORDS; i++) {
-        cdata[i] = Blowfish_stream2word(ciphertext, STR_SIZE(ciphertext), &j);
-    }
+    return output;
+}
 
-    /* Now do the encryption */
-    for (k = 0; k < 64; k++) {
-        blf_enc(&state, cdata, BCRYPT_WORDS / 2);
-    }
+typedef struct {
+    int cost;
+    // false if a hash could not be computed
+    bool succeeded;
+    // BCRYPT_MAXSALT random bytes per password
+    uint8_t *raw_salts;
+    // all the hashes are written in a single binary (*whole*), the elements of the list are sub-binaries of it
+    unsigned char *hashes;
+    ERL_NIF_TERM whole, *results;
+} bcrypt_hash_many_t;
+
+static bool bcrypt_hash_many_prepare(bcrypt_batch_t *batch, bcrypt_job_t *job, ERL_NIF_TERM head)
+{
+    ErlNifBinary password;
+    bcrypt_hash_many_t *context = batch->data;
+    uint8_t salt[BCRYPT_SALTSPACE], password0[BCRYPT_MAX_KEY_LEN], *password0_end;
+    const uint8_t *raw_salt = context->raw_salts + job->index * BCRYPT_MAXSALT;
 
-    for (i = 0; i < BCRYPT_WORDS; i++) {
-        ciphertext[4 * i + 3] = cdata[i] & 0xFF;
-        cdata[i] = cdata[i] >> 8;
-        ciphertext[4 * i + 2] = cdata[i] & 0xFF;
-        cdata[i] = cdata[i] >> 8;
-        ciphertext[4 * i + 1] = cdata[i] & 0xFF;
-        cdata[i] = cdata[i] >> 8;
-        ciphertext[4 * i + 0] = cdata[i] & 0xFF;
+    if (
+           enif_inspect_binary(batch->env, head, &password)
+        && NULL != bcrypt_init_salt(BCRYPT_MINOR, context->cost, raw_salt, raw_salt + BCRYPT_MAXSALT, salt, salt + STR_SIZE(salt))
+    ) {
+        password0_end = memcpy_l(password.data, password.data + password.size, password0, password0 + STR_SIZE(password0));
+        bcrypt_job_prepare(job, password0, password0_end, salt, salt + STR_SIZE(salt));
+        explicit_bzero(password0, sizeof(password0));
     }
 
-    do {
-        if (NULL == (w = write_prefix(hash, hash_end, minor, cost))) {
-            break; // ENCODING_FAIL
-        }
-        if (NULL == (w = encode_base64(raw_salt, raw_salt_end, w, hash_end))) {
-            break; // ENCODING_FAIL
-        }
-        if (NULL == (w = encode_base64(ciphertext, ciphertext + STR_LEN(ciphertext), w, hash_end))) {
-            break; // ENCODING_FAIL
-        }
-    } while (false);
-    explicit_bzero(cdata, sizeof(cdata));
-    explicit_bzero(&state, sizeof(state));
-    explicit_bzero(raw_salt, sizeof(raw_salt));
-    explicit_bzero(ciphertext, sizeof(ciphertext));
-
-    return w;
+    return job->prepared;
 }
 
-#ifndef STANDALONE
-static bool c_string_to_erlang_binary(ErlNifEnv *env, ERL_NIF_TERM *output, const uint8_t * const data, size_t data_len)
+static void bcrypt_hash_many_complete(bcrypt_batch_t *batch, bcrypt_job_t *job)
 {
-    unsigned char *buffer;
+    bcrypt_hash_many_t *context = batch->data;
 
-    assert(NULL != data);
-    if (NULL == (buffer = enif_make_new_binary(env, data_len, output))) {
-        *output = enif_make_badarg(env); // TODO: something better/more explicit?
+    if (job->hash + STR_SIZE(job->hash) == job->hash_end) {
+        memcpy(context->hashes + job->index * STR_SIZE(job->hash), job->hash, STR_SIZE(job->hash));
+        context->results[job->index] = enif_make_sub_binary(batch->env, context->whole, job->index * STR_SIZE(job->hash), STR_SIZE(job->hash));
     } else {
-        memcpy(buffer, data, data_len);
+        context->succeeded = false;
     }
-
-    return NULL != buffer;
 }
 
-static ERL_NIF_TERM expassword_bcrypt_generate_salt_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
+static ERL_NIF_TERM expassword_bcrypt_hash_many_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
 {
     int cost;
+    unsigned int count;
     ERL_NIF_TERM output;
-    ErlNifBinary raw_salt;
 
     if (
            2 == argc
-        && enif_inspect_binary(env, argv[0], &raw_salt)
+        && enif_get_list_length(env, argv[0], &count)
         && enif_is_map(env, argv[1])
         && extract_options_from_erlang_map(env, argv[1], &cost)
     ) {
-        uint8_t salt[BCRYPT_SALTSPACE];
-
-        if (NULL == bcrypt_init_salt(BCRYPT_MINOR, cost, raw_salt.data, raw_salt.data + raw_salt.size, salt, salt + STR_SIZE(salt))) {
+        bcrypt_batch_t batch;
+        bcrypt_hash_many_t context;
+
+        context.cost = cost;
+        context.succeeded = true;
+        context.results = NULL;
+        context.raw_salts = NULL;
+        if (
+               (count > 0 && NULL == (context.results = enif_alloc(count * sizeof(*context.results))))
+            || (count > 0 && NULL == (context.raw_salts = enif_alloc(count * BCRYPT_MAXSALT)))
+            || !bcrypt_random_bytes(context.raw_salts, count * BCRYPT_MAXSALT)
+            || NULL == (context.hashes = enif_make_new_binary(env, count * (BCRYPT_HASHSPACE - 1), &context.whole))
+        ) {
             output = enif_make_badarg(env);
         } else {
-            c_string_to_erlang_binary(env, &output, salt, STR_SIZE(salt));
+            batch.check = bcrypt_batch_check_binary;
+            batch.prepare = bcrypt_hash_many_prepare;
+            batch.complete = bcrypt_hash_many_complete;
+            batch.data = &context;
+            if (bcrypt_batch_run(&batch, env, argv[0], count) && context.succeeded) {
+                output = enif_make_list_from_array(env, context.results, count);
+            } else {
+                output = enif_make_badarg(env);
+            }
+        }
+        if (NULL != context.raw_salts) {
+            explicit_bzero(context.raw_salts, count * BCRYPT_MAXSALT);
+            enif_free(context.raw_salts);
+        }
+        if (NULL != context.results) {
+            enif_free(context.results);
         }
     } else {
         output = enif_make_badarg(env);
@@ -401,38 +1804,82 @@ static ERL_NIF_TERM expassword_bcrypt_generate_salt_nif(ErlNifEnv *env, int argc
     return output;
 }
 
-static uint8_t *memcpy_l(const uint8_t *from, const uint8_t * const from_end, uint8_t *to, const uint8_t * const to_end)
+typedef struct {
+    const uint32_t *password_key;
+    // index of the first matching hash or -1
+    long match;
+} bcrypt_matches_any_t;
+
+static bool bcrypt_matches_any_check(bcrypt_batch_t *batch, ERL_NIF_TERM head)
 {
-    while (to < to_end && from < from_end) {
-        *to++ = *from++;
-    }
-    if (to < to_end) {
-      *to++ = '\0';
-    }
+    return bcrypt_batch_check_hash(batch->env, head);
+}
 
-    return to;
+static bool bcrypt_matches_any_prepare(bcrypt_batch_t *batch, bcrypt_job_t *job, ERL_NIF_TERM head)
+{
+    bcrypt_matches_any_t *context = batch->data;
+
+    return
+           enif_inspect_binary(batch->env, head, &job->reference)
+        && bcrypt_job_prepare_scheduled(job, context->password_key, job->reference.data, job->reference.data + job->reference.size)
+    ;
 }
 
-static ERL_NIF_TERM expassword_bcrypt_hash_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
+static void bcrypt_matches_any_complete(bcrypt_batch_t *batch, bcrypt_job_t *job)
+{
+    bcrypt_matches_any_t *context = batch->data;
+
+    if (bcrypt_job_matches(job, &job->reference)) {
+        // the jobs still running may complete after this one but with a greater index
+        if (-1 == context->match || (long) job->index < context->match) {
+            context->match = (long) job->index;
+        }
+        // no need to go further into the list
+        batch->stop = true;
+    }
+}
+
+static ERL_NIF_TERM expassword_bcrypt_matches_any_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
 {
+    unsigned int count;
     ERL_NIF_TERM output;
-    ErlNifBinary password, salt;
+    ErlNifBinary password;
 
     if (
            2 == argc
         && enif_inspect_binary(env, argv[0], &password)
-        && enif_inspect_binary(env, argv[1], &salt)
+        && enif_get_list_length(env, argv[1], &count)
     ) {
-        uint8_t hash[BCRYPT_HASHSPACE - 1], password0[BCRYPT_MAX_KEY_LEN], *password0_end;
+        bool valid;
+        size_t password_len;
+        bcrypt_batch_t batch;
+        bcrypt_matches_any_t context;
+        uint32_t password_key[BLF_N + 2];
+        uint8_t password0[BCRYPT_MAX_KEY_LEN], *password0_end;
 
         password0_end = memcpy_l(password.data, password.data + password.size, password0, password0 + STR_SIZE(password0));
-        if (NULL != bcrypt_hash(password0, password0_end, salt.data, salt.data + salt.size, hash, hash + STR_SIZE(hash))) {
-            c_string_to_erlang_binary(env, &output, hash, STR_SIZE(hash));
-        } else {
-            output = enif_make_badarg(env);
+        // the key schedule of the password is computed once for all the hashes
+        if ((valid = bcrypt_password_length(BCRYPT_MINOR, password0, password0_end, &password_len))) {
+            eksblowfish_key_schedule(password_key, password0, password_len);
         }
-//         explicit_bzero(hash, sizeof(hash));
         explicit_bzero(password0, sizeof(password0));
+        if (valid) {
+            context.match = -1;
+            context.password_key = password_key;
+            batch.check = bcrypt_matches_any_check;
+            batch.prepare = bcrypt_matches_any_prepare;
+            batch.complete = bcrypt_matches_any_complete;
+            batch.data = &context;
+            valid = bcrypt_batch_run(&batch, env, argv[1], count);
+        }
+        if (!valid) {
+            output = enif_make_badarg(env);
+        } else if (-1 == context.match) {
+            output = atom_nil;
+        } else {
+            output = enif_make_long(env, context.match);
+        }
+        explicit_bzero(password_key, sizeof(password_key));
     } else {
         output = enif_make_badarg(env);
     }
@@ -440,27 +1887,73 @@ static ERL_NIF_TERM expassword_bcrypt_hash_nif(ErlNifEnv *env, int argc, const E
     return output;
 }
 
-static ERL_NIF_TERM expassword_bcrypt_verify_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
+typedef struct {
+    const bcrypt_state_t *parsed;
+    const ErlNifBinary *goodhash;
+    bool match;
+} bcrypt_verify_any_t;
+
+static bool bcrypt_verify_any_prepare(bcrypt_batch_t *batch, bcrypt_job_t *job, ERL_NIF_TERM head)
+{
+    ErlNifBinary password;
+    bcrypt_verify_any_t *context = batch->data;
+
+    if (enif_inspect_binary(batch->env, head, &password)) {
+        uint8_t password0[BCRYPT_MAX_KEY_LEN], *password0_end;
+
+        password0_end = memcpy_l(password.data, password.data + password.size, password0, password0 + STR_SIZE(password0));
+        bcrypt_job_prepare_parsed(job, context->parsed, password0, password0_end);
+        explicit_bzero(password0, sizeof(password0));
+
+        return true;
+    }
+
+    return false;
+}
+
+static void bcrypt_verify_any_complete(bcrypt_batch_t *batch, bcrypt_job_t *job)
+{
+    bcrypt_verify_any_t *context = batch->data;
+
+    // all the candidates are hashed and compared, whichever matches, to not leak it through timing
+    context->match |= bcrypt_job_matches(job, context->goodhash);
+}
+
+static ERL_NIF_TERM expassword_bcrypt_verify_any_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
 {
+    unsigned int count;
     ERL_NIF_TERM output;
-    ErlNifBinary password, goodhash;
+    ErlNifBinary goodhash;
 
     if (
            2 == argc
-        && enif_inspect_binary(env, argv[0], &password)
+        && enif_get_list_length(env, argv[0], &count)
         && enif_inspect_binary(env, argv[1], &goodhash)
         && bcrypt_valid_hash(&goodhash)
     ) {
-        uint8_t *p, hash[BCRYPT_HASHSPACE - 1], password0[BCRYPT_MAX_KEY_LEN], *password0_end;
-
-        password0_end = memcpy_l(password.data, password.data + password.size, password0, password0 + STR_SIZE(password0));
-        if (NULL != (p = bcrypt_hash(password0, password0_end, goodhash.data, goodhash.data + goodhash.size, hash, hash + STR_SIZE(hash)))) {
-            output = p > hash && goodhash.size == ((size_t) (p - hash)) && 0 == timingsafe_bcmp(goodhash.data, hash, STR_SIZE(hash)) ? atom_true : atom_false;
+        bool valid;
+        bcrypt_batch_t batch;
+        bcrypt_state_t parsed;
+        bcrypt_verify_any_t context;
+
+        // the version, the cost and the salt are decoded once for all the candidates
+        valid = NULL != bcrypt_full_parse_hash(goodhash.data, goodhash.data + goodhash.size, &parsed.minor, &parsed.cost, parsed.raw_salt, parsed.raw_salt + STR_SIZE(parsed.raw_salt));
+        if (valid) {
+            context.parsed = &parsed;
+            context.goodhash = &goodhash;
+            context.match = false;
+            batch.check = bcrypt_batch_check_binary;
+            batch.prepare = bcrypt_verify_any_prepare;
+            batch.complete = bcrypt_verify_any_complete;
+            batch.data = &context;
+            valid = bcrypt_batch_run(&batch, env, argv[0], count);
+        }
+        if (valid) {
+            output = context.match ? atom_true : atom_false;
         } else {
-            output = atom_false;
+            output = enif_make_badarg(env);
         }
-//         explicit_bzero(hash, sizeof(hash));
-        explicit_bzero(password0, sizeof(password0));
+        explicit_bzero(&parsed, sizeof(parsed));
     } else {
         output = enif_make_badarg(env);
     }
@@ -482,6 +1975,26 @@ static ERL_NIF_TERM expassword_bcrypt_valid_nif(ErlNifEnv *env, int argc, const
     return output;
 }
 
+/**
+ * Extracts the cost of *term*, either a handle returned by parse_hash_nif
+ * or a hash (false if it is not a valid one).
+ */
+static bool bcrypt_get_cost(ErlNifEnv *env, ERL_NIF_TERM term, int *cost)
+{
+    bool ok;
+    ErlNifBinary hash;
+    bcrypt_parsed_hash_t *parsed;
+
+    if (enif_get_resource(env, term, parsed_hash_type, (void **) &parsed)) {
+        *cost = parsed->cost;
+        ok = true;
+    } else {
+        ok = enif_inspect_binary(env, term, &hash) && bcrypt_valid_hash(&hash) && bcrypt_parse_hash(&hash, cost);
+    }
+
+    return ok;
+}
+
 static ERL_NIF_TERM expassword_bcrypt_get_options_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
 {
     enum {
@@ -489,12 +2002,11 @@ static ERL_NIF_TERM expassword_bcrypt_get_options_nif(ErlNifEnv *env, int argc,
         _BCRYPT_OPTIONS_COUNT,
     };
     int cost;
-    ErlNifBinary hash;
     ERL_NIF_TERM output;
 
-    if (1 != argc || !enif_inspect_binary(env, argv[0], &hash)) {
+    if (1 != argc) {
         output = enif_make_badarg(env);
-    } else if (bcrypt_valid_hash(&hash) && bcrypt_parse_hash(&hash, &cost)) {
+    } else if (bcrypt_get_cost(env, argv[0], &cost)) {
         ERL_NIF_TERM options;
         ERL_NIF_TERM keys[_BCRYPT_OPTIONS_COUNT], values[_BCRYPT_OPTIONS_COUNT];
 
@@ -503,8 +2015,10 @@ static ERL_NIF_TERM expassword_bcrypt_get_options_nif(ErlNifEnv *env, int argc,
         enif_make_map_from_arrays(env, keys, values, _BCRYPT_OPTIONS_COUNT, &options);
 
         output = enif_make_tuple2(env, atom_ok, options);
-    } else {
+    } else if (enif_is_binary(env, argv[0])) {
         output = enif_make_tuple2(env, atom_error, atom_invalid);
+    } else {
+        output = enif_make_badarg(env);
     }
 
     return output;
@@ -512,17 +2026,14 @@ static ERL_NIF_TERM expassword_bcrypt_get_options_nif(ErlNifEnv *env, int argc,
 
 static ERL_NIF_TERM expassword_bcrypt_needs_rehash_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
 {
-    ErlNifBinary hash;
     ERL_NIF_TERM output;
     int old_cost, new_cost;
 
     if (
            2 == argc
-        && enif_inspect_binary(env, argv[0], &hash)
         && enif_is_map(env, argv[1])
         && extract_options_from_erlang_map(env, argv[1], &new_cost)
-        && bcrypt_valid_hash(&hash)
-        && bcrypt_parse_hash(&hash, &old_cost)
+        && bcrypt_get_cost(env, argv[0], &old_cost)
     ) {
         output = old_cost != new_cost ? atom_true : atom_false;
     } else {
@@ -532,6 +2043,231 @@ static ERL_NIF_TERM expassword_bcrypt_needs_rehash_nif(ErlNifEnv *env, int argc,
     return output;
 }
 
+/**
+ * Bulk inspection: inspect_many_nif checks a binary made of hashes of
+ * BCRYPT_HASHSPACE - 1 bytes laid end to end and returns, as binaries,
+ * the cost of each one (0 if invalid) then the bitmaps (MSB first) of the
+ * valid ones and of the ones to rehash with the given cost.
+ *
+ * It is not a dirty NIF: the hashes are inspected by chunks and, when
+ * the timeslice of the process is consumed, the NIF is rescheduled to go
+ * on where it stopped. The results are written in a resource the binaries
+ * point into so they are not copied.
+ */
+#define BCRYPT_INSPECT_CHUNK 4096 /* hashes inspected between 2 checks of the time */
+#define BCRYPT_TIMESLICE 1000000 /* in ns, the approximate duration of a timeslice */
+
+typedef struct {
+    size_t count, done;
+    int cost;
+    // count costs then the 2 bitmaps of (count + 7) / 8 bytes
+    uint8_t data[];
+} bcrypt_inspection_t;
+
+static ErlNifResourceType *inspection_type;
+
+static ERL_NIF_TERM expassword_bcrypt_inspect_many_continue(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
+{
+    int reported;
+    size_t bitmap_size;
+    ErlNifBinary hashes;
+    struct timespec start, now;
+    bcrypt_inspection_t *inspection;
+    uint8_t *costs, *valid, *rehash;
+
+    if (
+           2 != argc
+        || !enif_inspect_binary(env, argv[0], &hashes)
+        || !enif_get_resource(env, argv[1], inspection_type, (void **) &inspection)
+    ) {
+        return enif_make_badarg(env);
+    }
+    bitmap_size = (inspection->count + 7) / 8;
+    costs = inspection->data;
+    valid = costs + inspection->count;
+    rehash = valid + bitmap_size;
+    reported = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (inspection->done < inspection->count) {
+        int percent;
+        size_t i, end;
+
+        end = inspection->count - inspection->done > BCRYPT_INSPECT_CHUNK ? inspection->done + BCRYPT_INSPECT_CHUNK : inspection->count;
+        for (i = inspection->done; i < end; i++) {
+            int cost;
+
+            costs[i] = cost = bcrypt_inspect_hash(hashes.data + i * (BCRYPT_HASHSPACE - 1));
+            if (0 != cost) {
+                valid[i >> 3] |= 0x80 >> (i & 7);
+                if (cost != inspection->cost) {
+                    rehash[i >> 3] |= 0x80 >> (i & 7);
+                }
+            }
+        }
+        inspection->done = end;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        percent = (int) ((((long long) (now.tv_sec - start.tv_sec)) * 1000000000 + (now.tv_nsec - start.tv_nsec)) * 100 / BCRYPT_TIMESLICE);
+        if (percent > 100) {
+            percent = 100;
+        }
+        if (percent > reported) {
+            // enif_consume_timeslice expects the percentage consumed since its previous call
+            if (enif_consume_timeslice(env, percent - reported) && inspection->done < inspection->count) {
+                return enif_schedule_nif(env, "inspect_many_nif", 0, expassword_bcrypt_inspect_many_continue, argc, argv);
+            }
+            reported = percent;
+        }
+    }
+
+    return enif_make_tuple3(
+        env,
+        enif_make_resource_binary(env, inspection, costs, inspection->count),
+        enif_make_resource_binary(env, inspection, valid, bitmap_size),
+        enif_make_resource_binary(env, inspection, rehash, bitmap_size)
+    );
+}
+
+static ERL_NIF_TERM expassword_bcrypt_inspect_many_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
+{
+    int cost;
+    ErlNifBinary hashes;
+    ERL_NIF_TERM output;
+
+    if (
+           2 == argc
+        && enif_inspect_binary(env, argv[0], &hashes)
+        && 0 == hashes.size % (BCRYPT_HASHSPACE - 1)
+        && enif_is_map(env, argv[1])
+        && extract_options_from_erlang_map(env, argv[1], &cost)
+    ) {
+        size_t count, bitmap_size;
+        bcrypt_inspection_t *inspection;
+
+        count = hashes.size / (BCRYPT_HASHSPACE - 1);
+        bitmap_size = (count + 7) / 8;
+        if (NULL == (inspection = enif_alloc_resource(inspection_type, sizeof(*inspection) + count + 2 * bitmap_size))) {
+            output = enif_make_badarg(env);
+        } else {
+            ERL_NIF_TERM args[2];
+
+            inspection->count = count;
+            inspection->done = 0;
+            inspection->cost = cost;
+            memset(inspection->data + count, 0, 2 * bitmap_size);
+            args[0] = argv[0];
+            args[1] = enif_make_resource(env, inspection);
+            // the term (then the binaries) keeps the resource alive
+            enif_release_resource(inspection);
+            output = expassword_bcrypt_inspect_many_continue(env, ARRAY_SIZE(args), args);
+        }
+    } else {
+        output = enif_make_badarg(env);
+    }
+
+    return output;
+}
+
+static ERL_NIF_TERM expassword_bcrypt_kernel_info_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM UNUSED(argv[]))
+{
+    enum {
+        KERNEL_INFO_NAME,
+        KERNEL_INFO_LANES,
+        KERNEL_INFO_SUPPORTED,
+        KERNEL_INFO_RATE,
+        _KERNEL_INFO_COUNT,
+    };
+    ERL_NIF_TERM output;
+
+    if (0 == argc) {
+        size_t i;
+        ERL_NIF_TERM kernels, keys[_KERNEL_INFO_COUNT], values[_KERNEL_INFO_COUNT];
+
+        keys[KERNEL_INFO_NAME] = atom_name;
+        keys[KERNEL_INFO_LANES] = atom_lanes;
+        keys[KERNEL_INFO_SUPPORTED] = atom_supported;
+        keys[KERNEL_INFO_RATE] = atom_rate;
+        kernels = enif_make_list(env, 0);
+        for (i = eksblowfish_kernel_count(); i > 0; i--) {
+            ERL_NIF_TERM info;
+            const eksblowfish_kernel_t *kernel = eksblowfish_kernel_at(i - 1);
+
+            values[KERNEL_INFO_NAME] = enif_make_atom(env, kernel->name);
+            values[KERNEL_INFO_LANES] = enif_make_uint64(env, kernel->lanes);
+            values[KERNEL_INFO_SUPPORTED] = eksblowfish_kernel_supported(kernel) ? atom_true : atom_false;
+            values[KERNEL_INFO_RATE] = enif_make_double(env, kernel->rate);
+            enif_make_map_from_arrays(env, keys, values, _KERNEL_INFO_COUNT, &info);
+            kernels = enif_make_list_cell(env, info, kernels);
+        }
+        output = enif_make_new_map(env);
+        enif_make_map_put(env, output, atom_kernel, enif_make_atom(env, eksblowfish_kernel()->name), &output);
+        enif_make_map_put(env, output, atom_lanes, enif_make_uint64(env, eksblowfish_kernel()->lanes), &output);
+        enif_make_map_put(env, output, atom_kernels, kernels, &output);
+        enif_make_map_put(env, output, atom_backend, enif_make_atom(env, bcrypt_backend()), &output);
+    } else {
+        output = enif_make_badarg(env);
+    }
+
+    return output;
+}
+
+static ERL_NIF_TERM expassword_bcrypt_utilization_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM UNUSED(argv[]))
+{
+    ERL_NIF_TERM output;
+
+    if (0 == argc) {
+        size_t l;
+        eksblowfish_utilization_t copy;
+        ERL_NIF_TERM busy[EKSBLOWFISH_LANES_MAX];
+
+        enif_mutex_lock(utilization_lock);
+        copy = utilization;
+        enif_mutex_unlock(utilization_lock);
+        if (0 == copy.lanes) {
+            // no batch was run yet
+            copy.lanes = eksblowfish_kernel()->lanes;
+        }
+        for (l = 0; l < copy.lanes; l++) {
+            busy[l] = enif_make_double(env, 0 == copy.elapsed ? 0.0 : (double) copy.busy[l] / copy.elapsed);
+        }
+        output = enif_make_new_map(env);
+        enif_make_map_put(env, output, atom_kernel, enif_make_atom(env, eksblowfish_kernel()->name), &output);
+        enif_make_map_put(env, output, atom_lanes, enif_make_uint64(env, copy.lanes), &output);
+        enif_make_map_put(env, output, atom_iterations, enif_make_uint64(env, copy.elapsed), &output);
+        enif_make_map_put(env, output, atom_busy, enif_make_list_from_array(env, busy, copy.lanes), &output);
+    } else {
+        output = enif_make_badarg(env);
+    }
+
+    return output;
+}
+
+static ERL_NIF_TERM expassword_bcrypt_single_flight_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM UNUSED(argv[]))
+{
+    ERL_NIF_TERM output;
+
+    if (0 == argc) {
+        size_t i;
+        unsigned int in_flight;
+        uint64_t computed, saved;
+
+        enif_mutex_lock(single_flight.lock);
+        computed = single_flight.computed;
+        saved = single_flight.saved;
+        for (in_flight = i = 0; i < ARRAY_SIZE(single_flight.flights); i++) {
+            in_flight += single_flight.flights[i].busy;
+        }
+        enif_mutex_unlock(single_flight.lock);
+        output = enif_make_new_map(env);
+        enif_make_map_put(env, output, atom_computed, enif_make_uint64(env, computed), &output);
+        enif_make_map_put(env, output, atom_saved, enif_make_uint64(env, saved), &output);
+        enif_make_map_put(env, output, atom_in_flight, enif_make_uint(env, in_flight), &output);
+    } else {
+        output = enif_make_badarg(env);
+    }
+
+    return output;
+}
+
 #if 0
 static ERL_NIF_TERM expassword_bcrypt_encode_base64_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
 {
@@ -578,16 +2314,53 @@ static ErlNifFunc expassword_bcrypt_nif_funcs[] =
 {
     {"generate_salt_nif", 2, expassword_bcrypt_generate_salt_nif, 0},
     {"hash_nif", 2, expassword_bcrypt_hash_nif, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+    {"hash_password_nif", 2, expassword_bcrypt_hash_password_nif, ERL_NIF_DIRTY_JOB_CPU_BOUND},
     {"verify_nif", 2, expassword_bcrypt_verify_nif, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+    {"verify_and_upgrade_nif", 3, expassword_bcrypt_verify_and_upgrade_nif, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+    {"verify_and_upgrade_async_nif", 3, expassword_bcrypt_verify_and_upgrade_async_nif, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+    {"parse_hash_nif", 1, expassword_bcrypt_parse_hash_nif, 0},
+    {"verify_parsed_nif", 2, expassword_bcrypt_verify_parsed_nif, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+    {"verify_many_nif", 1, expassword_bcrypt_verify_many_nif, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+    {"hash_many_nif", 2, expassword_bcrypt_hash_many_nif, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+    {"matches_any_nif", 2, expassword_bcrypt_matches_any_nif, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+    {"verify_any_nif", 2, expassword_bcrypt_verify_any_nif, ERL_NIF_DIRTY_JOB_CPU_BOUND},
     {"get_options_nif", 1, expassword_bcrypt_get_options_nif, 0},
     {"needs_rehash_nif", 2, expassword_bcrypt_needs_rehash_nif, 0},
     {"valid_nif", 1, expassword_bcrypt_valid_nif, 0},
+    {"inspect_many_nif", 2, expassword_bcrypt_inspect_many_nif, 0},
+    {"kernel_info_nif", 0, expassword_bcrypt_kernel_info_nif, 0},
+    {"utilization_nif", 0, expassword_bcrypt_utilization_nif, 0},
+    {"single_flight_nif", 0, expassword_bcrypt_single_flight_nif, 0},
 #if 0
     {"encode_base64_nif", 1, expassword_bcrypt_encode_base64_nif, 0},
     {"decode_base64_nif", 1, expassword_bcrypt_decode_base64_nif, 0},
 #endif
 };
 
+/**
+ * Destroys the mutexes and condition variables created so far by the load
+ * callback (the ones not created yet are NULL), on failure or unload.
+ */
+static void bcrypt_destroy_sync_objects(void)
+{
+    if (NULL != rehash.cond) {
+        enif_cond_destroy(rehash.cond);
+        rehash.cond = NULL;
+    }
+    if (NULL != rehash.lock) {
+        enif_mutex_destroy(rehash.lock);
+        rehash.lock = NULL;
+    }
+    if (NULL != single_flight.lock) {
+        enif_mutex_destroy(single_flight.lock);
+    }
+    explicit_bzero(&single_flight, sizeof(single_flight));
+    if (NULL != utilization_lock) {
+        enif_mutex_destroy(utilization_lock);
+        utilization_lock = NULL;
+    }
+}
+
 static int expassword_bcrypt_nif_load(ErlNifEnv *env, void **UNUSED(priv_data), ERL_NIF_TERM UNUSED(load_info))
 {
 #define ATOM(x) \
@@ -595,8 +2368,54 @@ static int expassword_bcrypt_nif_load(ErlNifEnv *env, void **UNUSED(priv_data),
 #include "atoms.h"
 #undef ATOM
 
+    if (NULL == (parsed_hash_type = enif_open_resource_type(env, NULL, "bcrypt_parsed_hash", bcrypt_parsed_hash_dtor, ERL_NIF_RT_CREATE, NULL))) {
+        return 1;
+    }
+    if (NULL == (inspection_type = enif_open_resource_type(env, NULL, "bcrypt_inspection", NULL, ERL_NIF_RT_CREATE, NULL))) {
+        return 1;
+    }
+    // pick the fastest EksBlowfish kernel for the CPU we are running on
+    eksblowfish_autotune();
+    // then the fastest implementation of bcrypt_hash
+    bcrypt_select_backend();
+    if (NULL == (utilization_lock = enif_mutex_create(utilization_lock_name))) {
+        return 1;
+    }
+    if (
+           NULL == (single_flight.lock = enif_mutex_create(single_flight_name))
+        || !bcrypt_random_bytes(single_flight.secret, STR_SIZE(single_flight.secret))
+    ) {
+        bcrypt_destroy_sync_objects();
+        return 1;
+    }
+    if (
+           NULL == (rehash.lock = enif_mutex_create(rehash_name))
+        || NULL == (rehash.cond = enif_cond_create(rehash_name))
+        || 0 != enif_thread_create(rehash_name, &rehash.thread, bcrypt_rehash_thread, NULL, NULL)
+    ) {
+        bcrypt_destroy_sync_objects();
+        return 1;
+    }
+
     return 0;
 }
 
-ERL_NIF_INIT(Elixir.ExPassword.Bcrypt.Base, expassword_bcrypt_nif_funcs, expassword_bcrypt_nif_load, NULL, NULL, NULL)
+static void expassword_bcrypt_nif_unload(ErlNifEnv *UNUSED(env), void *UNUSED(priv_data))
+{
+    size_t i;
+
+    enif_mutex_lock(rehash.lock);
+    rehash.stop = true;
+    enif_cond_signal(rehash.cond);
+    enif_mutex_unlock(rehash.lock);
+    enif_thread_join(rehash.thread, NULL);
+    // the rehashes still pending are dropped
+    for (i = 0; i < rehash.count; i++) {
+        enif_free_env(rehash.queue[(rehash.head + i) % ARRAY_SIZE(rehash.queue)].env);
+    }
+    explicit_bzero(rehash.queue, sizeof(rehash.queue));
+    bcrypt_destroy_sync_objects();
+}
+
+ERL_NIF_INIT(Elixir.ExPassword.Bcrypt.Base, expassword_bcrypt_nif_funcs, expassword_bcrypt_nif_load, NULL, NULL, expassword_bcrypt_nif_unload)
 #endif /* !STANDALONE */
@@ -46,9 +46,23 @@
 #define BLF_MAXKEYLEN ((BLF_N-2)*4)	/* 448 bits */
 #define BLF_MAXUTILIZED ((BLF_N+2)*4)	/* 576 bits */
 
-/* Blowfish context */
+/* Blowfish context: the S-Boxes start on a cache line (64 bytes) */
+#define BLF_ALIGNMENT 64
+#ifdef __GNUC__
+#define BLF_ALIGNED __attribute__((aligned(BLF_ALIGNMENT)))
+#else
+#define BLF_ALIGNED
+#endif
+
+/* Rounds up ptr to the alignment of blf_ctx: heap allocators (malloc,
+ * enif_alloc) do not guarantee it, so allocate BLF_ALIGNMENT - 1 more
+ * bytes, keep the raw pointer for free and use BLF_ALIGN(raw).
+ */
+#define BLF_ALIGN(ptr) \
+	((void *) (((uintptr_t) (ptr) + BLF_ALIGNMENT - 1) & ~(uintptr_t) (BLF_ALIGNMENT - 1)))
+
 typedef struct BlowfishContext {
-	uint32_t S[4][256];	/* S-Boxes */
+	uint32_t S[4][256] BLF_ALIGNED;	/* S-Boxes */
 	uint32_t P[BLF_N + 2];	/* Subkeys */
 } blf_ctx;
 
@@ -63,6 +77,20 @@ void Blowfish_decipher(blf_ctx *, uint32_t *, uint32_t *);
 void Blowfish_initstate(blf_ctx *);
 void Blowfish_expand0state(blf_ctx *, const uint8_t *, uint16_t);
 void Blowfish_expandstate(blf_ctx *, const uint8_t *, uint16_t, const uint8_t *, uint16_t);
+void Blowfish_expandstate_words(blf_ctx *, const uint32_t *, uint16_t, const uint32_t *);
+
+/* Interleaved Blowfish_expand0state over 2 or 4 independent states (precomputed key streams) */
+
+#define BLF_LANES_MAX 4
+
+void Blowfish_expand0state_x2(blf_ctx **, const uint32_t * const *);
+void Blowfish_expand0state_x4(blf_ctx **, const uint32_t * const *);
+
+/* Fused loops of bcrypt: Blowfish_expand0state alternating 2 keys, blf_enc */
+
+void Blowfish_expand0state_rounds(blf_ctx *, const uint32_t *, const uint32_t *,
+    uint32_t);
+void Blowfish_enc_rounds(blf_ctx *, uint32_t *, uint16_t, uint16_t);
 
 /* Standard Blowfish */
 
@@ -45,24 +45,38 @@
 #endif
 
 #include <sys/types.h>
+#include <string.h>
 #include <blf.h>
 
 #undef inline
 #ifdef __GNUC__
 #define inline __inline
+#define always_inline __inline __attribute__((always_inline))
 #else				/* !__GNUC__ */
 #define inline
+#define always_inline
 #endif				/* !__GNUC__ */
 
 #define DEF_WEAK(symbol) \
     /* NOP */
 
-/* Function for Feistel Networks */
+/*
+ * Function for Feistel Networks
+ *
+ * The 4 S-boxes are addressed through a single flat base pointer, as
+ * bytes: each byte of x is extracted already multiplied by the size of a
+ * word (a shift and a mask, no scaling left to do) and the S-box it
+ * indexes is selected by a constant displacement (S-box n starts at byte
+ * 1024 * n).
+ */
+
+#define BLF_SBOX(s, offset) \
+	(*(const uint32_t *) ((const uint8_t *) (s) + (offset)))
 
-#define F(s, x) ((((s)[        (((x)>>24)&0xFF)]  \
-		 + (s)[0x100 + (((x)>>16)&0xFF)]) \
-		 ^ (s)[0x200 + (((x)>> 8)&0xFF)]) \
-		 + (s)[0x300 + ( (x)     &0xFF)])
+#define F(s, x) (((BLF_SBOX(s,         ((x)>>22)&0x3FC)  \
+		 + BLF_SBOX(s, 0x400 + (((x)>>14)&0x3FC))) \
+		 ^ BLF_SBOX(s, 0x800 + (((x)>> 6)&0x3FC))) \
+		 + BLF_SBOX(s, 0xC00 + (((x)<< 2)&0x3FC)))
 
 #define BLFRND(s,p,i,j,n) (i ^= F(s,j) ^ (p)[n])
 
@@ -458,6 +472,210 @@ Blowfish_expand0state(blf_ctx *c, const uint8_t *key, uint16_t keybytes)
 }
 DEF_WEAK(Blowfish_expand0state);
 
+/*
+ * Interleaved variants of Blowfish_expand0state: the states of 2 or 4
+ * independent lanes are advanced in lockstep, round by round, so the
+ * S-box loads of one lane hide the latency of the other ones.
+ */
+
+#define BLFRND_LANES(c,i,j,n,lanes) \
+	do { \
+		int l; \
+		for (l = 0; l < (lanes); l++) \
+			BLFRND((uint32_t *) (c)[l]->S, (c)[l]->P, (i)[l], (j)[l], n); \
+	} while (0)
+
+static always_inline void
+Blowfish_encipher_lanes(blf_ctx **c, uint32_t *xl, uint32_t *xr, int lanes)
+{
+	int l;
+	uint32_t Xl[BLF_LANES_MAX];
+	uint32_t Xr[BLF_LANES_MAX];
+
+	for (l = 0; l < lanes; l++) {
+		Xl[l] = xl[l] ^ c[l]->P[0];
+		Xr[l] = xr[l];
+	}
+	BLFRND_LANES(c, Xr, Xl, 1, lanes); BLFRND_LANES(c, Xl, Xr, 2, lanes);
+	BLFRND_LANES(c, Xr, Xl, 3, lanes); BLFRND_LANES(c, Xl, Xr, 4, lanes);
+	BLFRND_LANES(c, Xr, Xl, 5, lanes); BLFRND_LANES(c, Xl, Xr, 6, lanes);
+	BLFRND_LANES(c, Xr, Xl, 7, lanes); BLFRND_LANES(c, Xl, Xr, 8, lanes);
+	BLFRND_LANES(c, Xr, Xl, 9, lanes); BLFRND_LANES(c, Xl, Xr, 10, lanes);
+	BLFRND_LANES(c, Xr, Xl, 11, lanes); BLFRND_LANES(c, Xl, Xr, 12, lanes);
+	BLFRND_LANES(c, Xr, Xl, 13, lanes); BLFRND_LANES(c, Xl, Xr, 14, lanes);
+	BLFRND_LANES(c, Xr, Xl, 15, lanes); BLFRND_LANES(c, Xl, Xr, 16, lanes);
+	for (l = 0; l < lanes; l++) {
+		xl[l] = Xr[l] ^ c[l]->P[17];
+		xr[l] = Xl[l];
+	}
+}
+
+static always_inline void
+Blowfish_expand0state_lanes(blf_ctx **c, const uint32_t * const *key,
+    int lanes)
+{
+	int l;
+	uint16_t i;
+	uint16_t k;
+	uint32_t datal[BLF_LANES_MAX];
+	uint32_t datar[BLF_LANES_MAX];
+
+	for (l = 0; l < lanes; l++) {
+		for (i = 0; i < BLF_N + 2; i++)
+			c[l]->P[i] ^= key[l][i];
+		datal[l] = 0x00000000;
+		datar[l] = 0x00000000;
+	}
+
+	for (i = 0; i < BLF_N + 2; i += 2) {
+		Blowfish_encipher_lanes(c, datal, datar, lanes);
+		for (l = 0; l < lanes; l++) {
+			c[l]->P[i] = datal[l];
+			c[l]->P[i + 1] = datar[l];
+		}
+	}
+
+	for (i = 0; i < 4; i++) {
+		for (k = 0; k < 256; k += 2) {
+			Blowfish_encipher_lanes(c, datal, datar, lanes);
+			for (l = 0; l < lanes; l++) {
+				c[l]->S[i][k] = datal[l];
+				c[l]->S[i][k + 1] = datar[l];
+			}
+		}
+	}
+}
+
+void
+Blowfish_expand0state_x2(blf_ctx **c, const uint32_t * const *key)
+{
+	Blowfish_expand0state_lanes(c, key, 2);
+}
+DEF_WEAK(Blowfish_expand0state_x2);
+
+void
+Blowfish_expand0state_x4(blf_ctx **c, const uint32_t * const *key)
+{
+	Blowfish_expand0state_lanes(c, key, 4);
+}
+DEF_WEAK(Blowfish_expand0state_x4);
+
+/*
+ * With HAVE_BLOWFISH_ASM, the assembly implementation from
+ * blowfish_x86_64.S is used instead of the 2 following loops.
+ */
+#ifndef HAVE_BLOWFISH_ASM
+/*
+ * Fused expensive loop of bcrypt: the P-array is copied into a local array
+ * (which cannot alias the S-boxes, so the compiler is free to keep it in
+ * registers) for all the rounds, the 16 Feistel rounds are inlined and the
+ * S-boxes are regenerated by pairs of words with a single 64-bit store.
+ */
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define BLF_STORE_PAIR(s,l,r) \
+	do { \
+		uint64_t pair = (uint64_t) (r) << 32 | (l); \
+		memcpy((s), &pair, sizeof(pair)); \
+	} while (0)
+#elif defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define BLF_STORE_PAIR(s,l,r) \
+	do { \
+		uint64_t pair = (uint64_t) (l) << 32 | (r); \
+		memcpy((s), &pair, sizeof(pair)); \
+	} while (0)
+#else
+#define BLF_STORE_PAIR(s,l,r) \
+	do { \
+		(s)[0] = (l); \
+		(s)[1] = (r); \
+	} while (0)
+#endif
+
+static always_inline void
+Blowfish_encipher_fused(const uint32_t *s, const uint32_t *p, uint32_t *xl,
+    uint32_t *xr)
+{
+	uint32_t Xl;
+	uint32_t Xr;
+
+	Xl = *xl ^ p[0];
+	Xr = *xr;
+	BLFRND(s, p, Xr, Xl, 1); BLFRND(s, p, Xl, Xr, 2);
+	BLFRND(s, p, Xr, Xl, 3); BLFRND(s, p, Xl, Xr, 4);
+	BLFRND(s, p, Xr, Xl, 5); BLFRND(s, p, Xl, Xr, 6);
+	BLFRND(s, p, Xr, Xl, 7); BLFRND(s, p, Xl, Xr, 8);
+	BLFRND(s, p, Xr, Xl, 9); BLFRND(s, p, Xl, Xr, 10);
+	BLFRND(s, p, Xr, Xl, 11); BLFRND(s, p, Xl, Xr, 12);
+	BLFRND(s, p, Xr, Xl, 13); BLFRND(s, p, Xl, Xr, 14);
+	BLFRND(s, p, Xr, Xl, 15); BLFRND(s, p, Xl, Xr, 16);
+	*xl = Xr ^ p[17];
+	*xr = Xl;
+}
+
+static always_inline void
+Blowfish_expand0state_fused(uint32_t *s, uint32_t *p, const uint32_t *key)
+{
+	uint16_t i;
+	uint32_t datal;
+	uint32_t datar;
+
+	for (i = 0; i < BLF_N + 2; i++)
+		p[i] ^= key[i];
+
+	datal = 0x00000000;
+	datar = 0x00000000;
+	for (i = 0; i < BLF_N + 2; i += 2) {
+		Blowfish_encipher_fused(s, p, &datal, &datar);
+
+		p[i] = datal;
+		p[i + 1] = datar;
+	}
+
+	for (i = 0; i < 4 * 256; i += 2) {
+		Blowfish_encipher_fused(s, p, &datal, &datar);
+
+		BLF_STORE_PAIR(&s[i], datal, datar);
+	}
+}
+
+/*
+ * Same as calling, rounds times, Blowfish_expand0state with key then with
+ * data, both given as their first BLF_N + 2 words of key stream.
+ */
+void
+Blowfish_expand0state_rounds(blf_ctx *c, const uint32_t *key,
+    const uint32_t *data, uint32_t rounds)
+{
+	uint32_t k;
+	uint32_t p[BLF_N + 2];
+
+	memcpy(p, c->P, sizeof(p));
+	for (k = 0; k < rounds; k++) {
+		Blowfish_expand0state_fused((uint32_t *) c->S, p, key);
+		Blowfish_expand0state_fused((uint32_t *) c->S, p, data);
+	}
+	memcpy(c->P, p, sizeof(p));
+
+	explicit_bzero(p, sizeof(p));
+}
+DEF_WEAK(Blowfish_expand0state_rounds);
+
+/*
+ * Same as calling, rounds times, blf_enc.
+ */
+void
+Blowfish_enc_rounds(blf_ctx *c, uint32_t *data, uint16_t blocks,
+    uint16_t rounds)
+{
+	uint16_t i;
+
+	for (i = 0; i < rounds; i++)
+		blf_enc(c, data, blocks);
+}
+DEF_WEAK(Blowfish_enc_rounds);
+#endif				/* !HAVE_BLOWFISH_ASM */
+
 
 void
 Blowfish_expandstate(blf_ctx *c, const uint8_t *data, uint16_t databytes,
@@ -503,6 +721,57 @@ Blowfish_expandstate(blf_ctx *c, const uint8_t *data, uint16_t databytes,
 }
 DEF_WEAK(Blowfish_expandstate);
 
+/*
+ * Blowfish_expandstate with precomputed key streams: key holds the first
+ * BLF_N + 2 words of the key stream and data the datawords words of one
+ * period of the data stream (which has to be a multiple of 4 bytes long).
+ */
+void
+Blowfish_expandstate_words(blf_ctx *c, const uint32_t *data,
+    uint16_t datawords, const uint32_t *key)
+{
+	uint16_t i;
+	uint16_t j;
+	uint16_t k;
+	uint32_t datal;
+	uint32_t datar;
+
+	for (i = 0; i < BLF_N + 2; i++)
+		c->P[i] ^= key[i];
+
+	j = 0;
+	datal = 0x00000000;
+	datar = 0x00000000;
+	for (i = 0; i < BLF_N + 2; i += 2) {
+		datal ^= data[j];
+		if (++j == datawords)
+			j = 0;
+		datar ^= data[j];
+		if (++j == datawords)
+			j = 0;
+		Blowfish_encipher(c, &datal, &datar);
+
+		c->P[i] = datal;
+		c->P[i + 1] = datar;
+	}
+
+	for (i = 0; i < 4; i++) {
+		for (k = 0; k < 256; k += 2) {
+			datal ^= data[j];
+			if (++j == datawords)
+				j = 0;
+			datar ^= data[j];
+			if (++j == datawords)
+				j = 0;
+			Blowfish_encipher(c, &datal, &datar);
+
+			c->S[i][k] = datal;
+			c->S[i][k + 1] = datar;
+		}
+	}
+}
+DEF_WEAK(Blowfish_expandstate_words);
+
 void
 blf_key(blf_ctx *c, const uint8_t *k, uint16_t len)
 {
@@ -31,3 +31,4 @@
 // NOTE: "+ 1" is commented because we don't count the \0
 #define	BCRYPT_SALTSPACE	(STR_LEN("$vm$cc$") + (BCRYPT_MAXSALT * 4 + 2) / 3/* + 1*/)
 #define	BCRYPT_HASHSPACE	61
+#define	BCRYPT_MAX_KEY_LEN	72
@@ -0,0 +1,352 @@
+#include <time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "eksblowfish.h"
+#include "common.h"
+
+typedef void (*Blowfish_expand0state_lanes_t)(blf_ctx **, const uint32_t * const *);
+
+// "OrpheanBeholderScryDoubt" as big-endian words
+static const uint32_t ciphertext[BCRYPT_WORDS] = {
+    0x4f727068, 0x65616e42, 0x65686f6c, 0x64657253, 0x63727944, 0x6f756274,
+};
+
+void eksblowfish_key_schedule(uint32_t key[BLF_N + 2], const uint8_t *data, uint16_t databytes)
+{
+    uint16_t i, j;
+
+    j = 0;
+    for (i = 0; i < BLF_N + 2; i++) {
+        key[i] = Blowfish_stream2word(data, databytes, &j);
+    }
+}
+
+void eksblowfish_setup(eksblowfish_lane_t *lane, const uint8_t *password, uint16_t password_len, const uint8_t *salt, int cost)
+{
+    eksblowfish_key_schedule(lane->password_key, password, password_len);
+    eksblowfish_setup_salt(lane, salt, cost);
+}
+
+void eksblowfish_setup_salt(eksblowfish_lane_t *lane, const uint8_t *salt, int cost)
+{
+    eksblowfish_key_schedule(lane->salt_key, salt, BCRYPT_MAXSALT);
+    lane->rounds = UINT32_C(1) << cost;
+    Blowfish_initstate(&lane->state);
+    // the stream of the salt has a period of BCRYPT_MAXSALT / 4 words
+    Blowfish_expandstate_words(&lane->state, lane->salt_key, BCRYPT_MAXSALT / 4, lane->password_key);
+}
+
+void eksblowfish_finalize(eksblowfish_lane_t *lane, uint32_t cdata[BCRYPT_WORDS])
+{
+    memcpy(cdata, ciphertext, sizeof(ciphertext));
+    Blowfish_enc_rounds(&lane->state, cdata, BCRYPT_WORDS / 2, 64);
+
+    explicit_bzero(lane, sizeof(*lane));
+}
+
+void eksblowfish_expand_x1(eksblowfish_lane_t **lanes, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        eksblowfish_lane_t *lane = lanes[i];
+
+        Blowfish_expand0state_rounds(&lane->state, lane->password_key, lane->salt_key, lane->rounds);
+        lane->rounds = 0;
+    }
+}
+
+void eksblowfish_expand_groups(
+    eksblowfish_lane_t **lanes, size_t count,
+    size_t width, eksblowfish_group_t group_expand,
+    eksblowfish_expand_t narrower
+) {
+    size_t i, l, active;
+    eksblowfish_lane_t *group[EKSBLOWFISH_LANES_MAX];
+
+    for (i = 0; i < count; /* NOP */) {
+        uint32_t common;
+
+        // gather the next *width* lanes which still have some work to do
+        for (active = 0; active < width && i < count; i++) {
+            if (lanes[i]->rounds > 0) {
+                group[active++] = lanes[i];
+            }
+        }
+        if (active < width) {
+            narrower(group, active);
+            break;
+        }
+        for (common = UINT32_MAX, l = 0; l < width; l++) {
+            if (group[l]->rounds < common) {
+                common = group[l]->rounds;
+            }
+        }
+        group_expand(group, common);
+        // lanes with a higher cost than the cheapest one of the group are completed by a narrower kernel
+        for (active = l = 0; l < width; l++) {
+            group[l]->rounds -= common;
+            if (group[l]->rounds > 0) {
+                group[active++] = group[l];
+            }
+        }
+        narrower(group, active);
+    }
+}
+
+static void eksblowfish_group_lanes(eksblowfish_lane_t **group, uint32_t rounds, size_t width, Blowfish_expand0state_lanes_t expand0state)
+{
+    size_t l;
+    uint32_t k;
+    blf_ctx *c[BLF_LANES_MAX];
+    const uint32_t *password[BLF_LANES_MAX], *salt[BLF_LANES_MAX];
+
+    for (l = 0; l < width; l++) {
+        c[l] = &group[l]->state;
+        password[l] = group[l]->password_key;
+        salt[l] = group[l]->salt_key;
+    }
+    for (k = 0; k < rounds; k++) {
+        expand0state(c, password);
+        expand0state(c, salt);
+    }
+}
+
+static void eksblowfish_group_x2(eksblowfish_lane_t **group, uint32_t rounds)
+{
+    eksblowfish_group_lanes(group, rounds, 2, Blowfish_expand0state_x2);
+}
+
+static void eksblowfish_group_x4(eksblowfish_lane_t **group, uint32_t rounds)
+{
+    eksblowfish_group_lanes(group, rounds, 4, Blowfish_expand0state_x4);
+}
+
+void eksblowfish_expand_x2(eksblowfish_lane_t **lanes, size_t count)
+{
+    eksblowfish_expand_groups(lanes, count, 2, eksblowfish_group_x2, eksblowfish_expand_x1);
+}
+
+void eksblowfish_expand_x4(eksblowfish_lane_t **lanes, size_t count)
+{
+    eksblowfish_expand_groups(lanes, count, 4, eksblowfish_group_x4, eksblowfish_expand_x2);
+}
+
+static eksblowfish_kernel_t kernels[] = {
+    { "x1", 1, NULL, eksblowfish_expand_x1, 0.0 },
+    { "x2", 2, NULL, eksblowfish_expand_x2, 0.0 },
+    { "x4", 4, NULL, eksblowfish_expand_x4, 0.0 },
+#ifdef HAVE_EKSBLOWFISH_VECTOR
+    { "vector_x4", 4, NULL, eksblowfish_expand_vector_x4, 0.0 },
+    { "vector_x8", 8, NULL, eksblowfish_expand_vector_x8, 0.0 },
+#endif /* HAVE_EKSBLOWFISH_VECTOR */
+#ifdef HAVE_EKSBLOWFISH_AVX2
+    { "avx2_x8", 8, eksblowfish_avx2_supported, eksblowfish_expand_avx2_x8, 0.0 },
+    { "avx2_x16", 16, eksblowfish_avx2_supported, eksblowfish_expand_avx2_x16, 0.0 },
+#endif /* HAVE_EKSBLOWFISH_AVX2 */
+#ifdef HAVE_EKSBLOWFISH_AVX512
+    { "avx512_x16", 16, eksblowfish_avx512_supported, eksblowfish_expand_avx512_x16, 0.0 },
+    { "avx512_x32", 32, eksblowfish_avx512_supported, eksblowfish_expand_avx512_x32, 0.0 },
+#endif /* HAVE_EKSBLOWFISH_AVX512 */
+};
+
+// the portable interleaved kernel until eksblowfish_autotune is called
+static const eksblowfish_kernel_t *selected = &kernels[2];
+
+size_t eksblowfish_kernel_count(void)
+{
+    return ARRAY_SIZE(kernels);
+}
+
+const eksblowfish_kernel_t *eksblowfish_kernel_at(size_t i)
+{
+    return i < ARRAY_SIZE(kernels) ? &kernels[i] : NULL;
+}
+
+bool eksblowfish_kernel_supported(const eksblowfish_kernel_t *kernel)
+{
+    return NULL == kernel->supported || kernel->supported();
+}
+
+const eksblowfish_kernel_t *eksblowfish_kernel(void)
+{
+    return selected;
+}
+
+void eksblowfish_expand(eksblowfish_lane_t **lanes, size_t count)
+{
+    selected->expand(lanes, count);
+}
+
+void eksblowfish_schedule(eksblowfish_next_t next, eksblowfish_done_t done, void *data, eksblowfish_utilization_t *utilization)
+{
+    bool drained;
+    size_t l, active, width;
+    uint32_t step, remaining[EKSBLOWFISH_LANES_MAX];
+    eksblowfish_lane_t *slots[EKSBLOWFISH_LANES_MAX], *group[EKSBLOWFISH_LANES_MAX];
+    // the kernel is not supposed to change meanwhile
+    const eksblowfish_kernel_t *kernel = selected;
+
+    drained = false;
+    width = kernel->lanes;
+    if (NULL != utilization) {
+        utilization->lanes = width;
+    }
+    for (l = 0; l < width; l++) {
+        slots[l] = NULL;
+    }
+    for (;;) {
+        // refill the empty slots (a lane without any round left is done right away)
+        for (l = 0; l < width && !drained; l++) {
+            while (NULL == slots[l] && !drained) {
+                if (NULL == (slots[l] = next(data))) {
+                    drained = true;
+                } else if (0 == slots[l]->rounds) {
+                    done(slots[l], data);
+                    slots[l] = NULL;
+                }
+            }
+        }
+        step = UINT32_MAX;
+        for (active = l = 0; l < width; l++) {
+            if (NULL != slots[l]) {
+                group[active++] = slots[l];
+                if (slots[l]->rounds < step) {
+                    step = slots[l]->rounds;
+                }
+            }
+        }
+        if (0 == active) {
+            break;
+        }
+        // run *step* rounds on every lane
+        for (l = 0; l < width; l++) {
+            if (NULL != slots[l]) {
+                remaining[l] = slots[l]->rounds;
+                slots[l]->rounds = step;
+            }
+        }
+        kernel->expand(group, active);
+        if (NULL != utilization) {
+            utilization->elapsed += step;
+        }
+        for (l = 0; l < width; l++) {
+            if (NULL != slots[l]) {
+                if (NULL != utilization) {
+                    utilization->busy[l] += step;
+                }
+                slots[l]->rounds = remaining[l] - step;
+                if (0 == slots[l]->rounds) {
+                    done(slots[l], data);
+                    slots[l] = NULL;
+                }
+            }
+        }
+    }
+}
+
+/*
+ * The states of the lanes are transposed in and out of the vector kernels
+ * once per group: at a low number of rounds this fixed cost would weigh
+ * much more than at the costs used in production and favour the narrower
+ * kernels. Each kernel is timed with BENCHMARK_ROUNDS_LOW then with
+ * BENCHMARK_ROUNDS_HIGH rounds per lane and only the difference, the cost
+ * of the additional rounds, is kept.
+ */
+#define BENCHMARK_ROUNDS_LOW 2
+#define BENCHMARK_ROUNDS_HIGH 18
+// minimum duration of the benchmark of a kernel, in seconds
+#define BENCHMARK_DURATION 0.005
+
+static double elapsed_since(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double) (now.tv_sec - start->tv_sec) + (double) (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// runs *rounds* rounds on a full group of lanes then on an incomplete one (*count* lanes in total)
+static double eksblowfish_benchmark_run(const eksblowfish_kernel_t *kernel, eksblowfish_lane_t *states, size_t count, uint32_t rounds)
+{
+    size_t l;
+    struct timespec start;
+    eksblowfish_lane_t *lanes[2 * EKSBLOWFISH_LANES_MAX];
+    const uint8_t password[] = "EksBlowfish", salt[BCRYPT_MAXSALT] = { 0 };
+
+    for (l = 0; l < count; l++) {
+        eksblowfish_setup(&states[l], password, STR_SIZE(password), salt, 0);
+        states[l].rounds = rounds;
+        lanes[l] = &states[l];
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    kernel->expand(lanes, kernel->lanes);
+    kernel->expand(lanes + kernel->lanes, count - kernel->lanes);
+
+    return elapsed_since(&start);
+}
+
+/*
+ * Returns the number of iterations of the expensive loop per second for a
+ * full group of lanes followed by an incomplete one (half of the lanes,
+ * left to the narrower kernels) as batches are not always a multiple of
+ * the width of the kernel.
+ */
+static double eksblowfish_benchmark(const eksblowfish_kernel_t *kernel)
+{
+    size_t count, runs;
+    uint32_t rounds;
+    void *raw;
+    double low, high, elapsed;
+    eksblowfish_lane_t *states;
+
+    count = kernel->lanes + kernel->lanes / 2;
+    if (NULL == (raw = malloc(count * sizeof(*states) + BLF_ALIGNMENT - 1))) {
+        return 0.0;
+    }
+    states = BLF_ALIGN(raw);
+    runs = 0;
+    low = high = 0.0;
+    do {
+        low += eksblowfish_benchmark_run(kernel, states, count, BENCHMARK_ROUNDS_LOW);
+        high += eksblowfish_benchmark_run(kernel, states, count, BENCHMARK_ROUNDS_HIGH);
+        ++runs;
+    } while (low + high < BENCHMARK_DURATION);
+    explicit_bzero(states, count * sizeof(*states));
+    free(raw);
+    if (high > low) {
+        rounds = BENCHMARK_ROUNDS_HIGH - BENCHMARK_ROUNDS_LOW;
+        elapsed = high - low;
+    } else {
+        // timer noise: keep the whole cost rather than a negative or null one
+        rounds = BENCHMARK_ROUNDS_HIGH;
+        elapsed = high;
+    }
+
+    return (double) runs * count * rounds / elapsed;
+}
+
+void eksblowfish_autotune(void)
+{
+    size_t i;
+    const eksblowfish_kernel_t *best;
+
+    // the rate of the kernel selected by a previous call is measured again like the others
+    best = NULL;
+    for (i = 0; i < ARRAY_SIZE(kernels); i++) {
+        if (eksblowfish_kernel_supported(&kernels[i])) {
+            kernels[i].rate = eksblowfish_benchmark(&kernels[i]);
+            if (NULL == best || kernels[i].rate > best->rate) {
+                best = &kernels[i];
+            }
+        } else {
+            kernels[i].rate = 0.0;
+        }
+    }
+    if (NULL != best) {
+        selected = best;
+    }
+}
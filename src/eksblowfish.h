@@ -0,0 +1,141 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "blf.h"
+
+#define BCRYPT_WORDS 6		/* Ciphertext words */
+
+// maximum number of lanes handled in lockstep by a kernel
+#define EKSBLOWFISH_LANES_MAX 32
+
+/**
+ * One independent bcrypt computation (a "lane"): its EksBlowfish state
+ * and the inputs of the expensive loop which are still to be processed.
+ */
+typedef struct {
+    blf_ctx state;
+    // key schedules: the first BLF_N + 2 words of the cyclic streams of the password and of the salt
+    uint32_t password_key[BLF_N + 2];
+    uint32_t salt_key[BLF_N + 2];
+    // number of remaining iterations of the expensive loop (initialized to 2^cost)
+    uint32_t rounds;
+} eksblowfish_lane_t;
+
+/**
+ * Steps 1 and 2 of the algorithm: InitState + ExpandKey(state, salt, password)
+ *
+ * The key schedules of the password and the salt (which has to be
+ * BCRYPT_MAXSALT bytes long) are computed once here, both buffers can be
+ * released after this call.
+ */
+void eksblowfish_setup(eksblowfish_lane_t *, const uint8_t *, uint16_t, const uint8_t *, int);
+
+/**
+ * Computes the key schedule of *data* (the first BLF_N + 2 words of its
+ * cyclic stream) as done by eksblowfish_setup for the password.
+ */
+void eksblowfish_key_schedule(uint32_t [BLF_N + 2], const uint8_t *, uint16_t);
+
+/**
+ * Same as eksblowfish_setup for a lane which password_key was already
+ * filled, for example by a copy of a key schedule shared by several lanes
+ * (the same password checked against several hashes).
+ */
+void eksblowfish_setup_salt(eksblowfish_lane_t *, const uint8_t *, int);
+
+/**
+ * Steps 4 and 5 of the algorithm: encrypts "OrpheanBeholderScryDoubt" 64
+ * times then wipes the lane.
+ */
+void eksblowfish_finalize(eksblowfish_lane_t *, uint32_t [BCRYPT_WORDS]);
+
+/**
+ * Step 3 of the algorithm, the expensive loop: runs all the remaining
+ * rounds of *count* lanes. Lanes may have different costs.
+ *
+ * The xN variants advance N lanes in lockstep (the remaining ones, if
+ * count is not a multiple of N, are processed by the narrower variants).
+ */
+typedef void (*eksblowfish_expand_t)(eksblowfish_lane_t **, size_t);
+
+void eksblowfish_expand_x1(eksblowfish_lane_t **, size_t);
+void eksblowfish_expand_x2(eksblowfish_lane_t **, size_t);
+void eksblowfish_expand_x4(eksblowfish_lane_t **, size_t);
+
+#ifdef HAVE_EKSBLOWFISH_VECTOR
+void eksblowfish_expand_vector_x4(eksblowfish_lane_t **, size_t);
+void eksblowfish_expand_vector_x8(eksblowfish_lane_t **, size_t);
+#endif /* HAVE_EKSBLOWFISH_VECTOR */
+
+#ifdef HAVE_EKSBLOWFISH_AVX2
+bool eksblowfish_avx2_supported(void);
+void eksblowfish_expand_avx2_x8(eksblowfish_lane_t **, size_t);
+void eksblowfish_expand_avx2_x16(eksblowfish_lane_t **, size_t);
+#endif /* HAVE_EKSBLOWFISH_AVX2 */
+
+#ifdef HAVE_EKSBLOWFISH_AVX512
+bool eksblowfish_avx512_supported(void);
+void eksblowfish_expand_avx512_x16(eksblowfish_lane_t **, size_t);
+void eksblowfish_expand_avx512_x32(eksblowfish_lane_t **, size_t);
+#endif /* HAVE_EKSBLOWFISH_AVX512 */
+
+/**
+ * Runtime dispatch: every kernel built in is registered with the number
+ * of lanes it processes at once and how to check that the CPU supports
+ * it. eksblowfish_autotune benchmarks the supported kernels for a few
+ * milliseconds each and selects the one with the highest throughput
+ * (the lane count included) for this host, eksblowfish_expand runs it.
+ */
+typedef struct {
+    const char *name;
+    size_t lanes;
+    bool (*supported)(void);
+    eksblowfish_expand_t expand;
+    // measured throughput: iterations of the expensive loop per second (0 if not supported)
+    double rate;
+} eksblowfish_kernel_t;
+
+size_t eksblowfish_kernel_count(void);
+const eksblowfish_kernel_t *eksblowfish_kernel_at(size_t);
+bool eksblowfish_kernel_supported(const eksblowfish_kernel_t *);
+const eksblowfish_kernel_t *eksblowfish_kernel(void);
+void eksblowfish_autotune(void);
+void eksblowfish_expand(eksblowfish_lane_t **, size_t);
+
+/**
+ * Continuous lane refill: the lanes of the selected kernel are fed from
+ * a queue (*next* returns the next lane to compute or NULL when there is
+ * no more). The kernel runs as many rounds as the lane closest to its
+ * completion has left, then the completed lanes are handed to *done* and
+ * their slots are immediately refilled from the queue, so lanes of
+ * different costs do not wait for the costliest one of their group.
+ *
+ * The busy/idle time of each lane (slot) is accumulated into
+ * *utilization* when it is not NULL.
+ */
+typedef eksblowfish_lane_t *(*eksblowfish_next_t)(void *);
+typedef void (*eksblowfish_done_t)(eksblowfish_lane_t *, void *);
+
+typedef struct {
+    // number of lanes of the kernel
+    size_t lanes;
+    // iterations of the expensive loop run by the kernel
+    uint64_t elapsed;
+    // iterations during which each lane had a job
+    uint64_t busy[EKSBLOWFISH_LANES_MAX];
+} eksblowfish_utilization_t;
+
+void eksblowfish_schedule(eksblowfish_next_t, eksblowfish_done_t, void *, eksblowfish_utilization_t *);
+
+/**
+ * Helper for kernel implementations: *group* runs the given number of
+ * rounds on exactly *width* lanes. The lanes are taken *width* by *width*,
+ * the ones which remain (lanes with a higher cost or a last incomplete
+ * group) are given to the *narrower* kernel.
+ */
+typedef void (*eksblowfish_group_t)(eksblowfish_lane_t **, uint32_t);
+
+void eksblowfish_expand_groups(eksblowfish_lane_t **, size_t, size_t, eksblowfish_group_t, eksblowfish_expand_t);
@@ -0,0 +1,198 @@
+#include <string.h>
+#include <immintrin.h>
+
+#include "eksblowfish.h"
+#include "common.h"
+
+/**
+ * 8 lanes EksBlowfish: the states are transposed in a lane-major layout
+ * (S[i] and P[i] hold the i-th word of the 8 lanes) so P-array loads and
+ * S-box writes are plain vector operations while the S-box lookups of the
+ * F function are done by vpgatherdd.
+ *
+ * The gathers have a high latency: the x16 variant interleaves the rounds
+ * of two independent groups of 8 lanes to hide it.
+ */
+
+#define LANES 8
+#define VECTORS_MAX 2
+
+typedef struct {
+    uint32_t S[4 * 256][LANES] __attribute__((aligned(32)));
+    uint32_t P[BLF_N + 2][LANES] __attribute__((aligned(32)));
+} blf_avx2_ctx;
+
+#define LOAD(v) _mm256_load_si256((const __m256i *) (v))
+#define STORE(v, x) _mm256_store_si256((__m256i *) (v), x)
+
+/*
+ * The index of the 32-bit word (b-th entry of the box) for the lane l is
+ * (b * LANES + l): the byte is directly extracted already shifted by 3
+ * from x and the lane is or-ed into the 3 lowest bits.
+ */
+#define GATHER(s, x, shift, lane) \
+    _mm256_i32gather_epi32((const int *) (s), _mm256_or_si256(_mm256_and_si256(shift(x), _mm256_set1_epi32(0xFF << 3)), lane), 4)
+
+#define SHIFT0(x) _mm256_srli_epi32(x, 24 - 3)
+#define SHIFT1(x) _mm256_srli_epi32(x, 16 - 3)
+#define SHIFT2(x) _mm256_srli_epi32(x, 8 - 3)
+#define SHIFT3(x) _mm256_slli_epi32(x, 3)
+
+#define F(c, x, lane) \
+    _mm256_add_epi32( \
+        _mm256_xor_si256( \
+            _mm256_add_epi32( \
+                GATHER((c)->S[0x000], x, SHIFT0, lane), \
+                GATHER((c)->S[0x100], x, SHIFT1, lane) \
+            ), \
+            GATHER((c)->S[0x200], x, SHIFT2, lane) \
+        ), \
+        GATHER((c)->S[0x300], x, SHIFT3, lane) \
+    )
+
+#define BLFRND(c, i, j, n, lane) \
+    i = _mm256_xor_si256(i, _mm256_xor_si256(F(c, j, lane), LOAD((c)->P[n])))
+
+#define BLFRND_VECTORS(c, i, j, n, lane, vectors) \
+    do { \
+        int _v; \
+        for (_v = 0; _v < (vectors); _v++) \
+            BLFRND(&(c)[_v], (i)[_v], (j)[_v], n, lane); \
+    } while (0)
+
+static inline __attribute__((always_inline)) void Blowfish_encipher_avx2(const blf_avx2_ctx *c, __m256i *xl, __m256i *xr, int vectors)
+{
+    int v;
+    __m256i Xl[VECTORS_MAX], Xr[VECTORS_MAX];
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    for (v = 0; v < vectors; v++) {
+        Xl[v] = _mm256_xor_si256(xl[v], LOAD(c[v].P[0]));
+        Xr[v] = xr[v];
+    }
+    BLFRND_VECTORS(c, Xr, Xl, 1, lane, vectors); BLFRND_VECTORS(c, Xl, Xr, 2, lane, vectors);
+    BLFRND_VECTORS(c, Xr, Xl, 3, lane, vectors); BLFRND_VECTORS(c, Xl, Xr, 4, lane, vectors);
+    BLFRND_VECTORS(c, Xr, Xl, 5, lane, vectors); BLFRND_VECTORS(c, Xl, Xr, 6, lane, vectors);
+    BLFRND_VECTORS(c, Xr, Xl, 7, lane, vectors); BLFRND_VECTORS(c, Xl, Xr, 8, lane, vectors);
+    BLFRND_VECTORS(c, Xr, Xl, 9, lane, vectors); BLFRND_VECTORS(c, Xl, Xr, 10, lane, vectors);
+    BLFRND_VECTORS(c, Xr, Xl, 11, lane, vectors); BLFRND_VECTORS(c, Xl, Xr, 12, lane, vectors);
+    BLFRND_VECTORS(c, Xr, Xl, 13, lane, vectors); BLFRND_VECTORS(c, Xl, Xr, 14, lane, vectors);
+    BLFRND_VECTORS(c, Xr, Xl, 15, lane, vectors); BLFRND_VECTORS(c, Xl, Xr, 16, lane, vectors);
+    for (v = 0; v < vectors; v++) {
+        xl[v] = _mm256_xor_si256(Xr[v], LOAD(c[v].P[17]));
+        xr[v] = Xl[v];
+    }
+}
+
+static inline __attribute__((always_inline)) void Blowfish_expand0state_avx2(blf_avx2_ctx *c, __m256i (*key)[BLF_N + 2], int vectors)
+{
+    int i, v;
+    __m256i datal[VECTORS_MAX], datar[VECTORS_MAX];
+
+    for (v = 0; v < vectors; v++) {
+        for (i = 0; i < BLF_N + 2; i++) {
+            STORE(c[v].P[i], _mm256_xor_si256(LOAD(c[v].P[i]), key[v][i]));
+        }
+        datal[v] = datar[v] = _mm256_setzero_si256();
+    }
+    for (i = 0; i < BLF_N + 2; i += 2) {
+        Blowfish_encipher_avx2(c, datal, datar, vectors);
+        for (v = 0; v < vectors; v++) {
+            STORE(c[v].P[i], datal[v]);
+            STORE(c[v].P[i + 1], datar[v]);
+        }
+    }
+    for (i = 0; i < 4 * 256; i += 2) {
+        Blowfish_encipher_avx2(c, datal, datar, vectors);
+        for (v = 0; v < vectors; v++) {
+            STORE(c[v].S[i], datal[v]);
+            STORE(c[v].S[i + 1], datar[v]);
+        }
+    }
+}
+
+// transposes the key schedule of each lane into vectors
+static void eksblowfish_key_avx2(__m256i *key, eksblowfish_lane_t **group, bool salt)
+{
+    int i, l;
+    uint32_t transposed[BLF_N + 2][LANES];
+
+    for (l = 0; l < LANES; l++) {
+        const uint32_t *words = salt ? group[l]->salt_key : group[l]->password_key;
+
+        for (i = 0; i < BLF_N + 2; i++) {
+            transposed[i][l] = words[i];
+        }
+    }
+    for (i = 0; i < BLF_N + 2; i++) {
+        key[i] = _mm256_loadu_si256((const __m256i *) transposed[i]);
+    }
+    explicit_bzero(transposed, sizeof(transposed));
+}
+
+static inline __attribute__((always_inline)) void eksblowfish_group_avx2(eksblowfish_lane_t **group, uint32_t rounds, int vectors)
+{
+    int i, l, v;
+    uint32_t k;
+    blf_avx2_ctx c[VECTORS_MAX];
+    __m256i password[VECTORS_MAX][BLF_N + 2], salt[VECTORS_MAX][BLF_N + 2];
+
+    for (v = 0; v < vectors; v++) {
+        for (l = 0; l < LANES; l++) {
+            const blf_ctx *state = &group[v * LANES + l]->state;
+
+            for (i = 0; i < 4 * 256; i++) {
+                c[v].S[i][l] = state->S[i / 256][i % 256];
+            }
+            for (i = 0; i < BLF_N + 2; i++) {
+                c[v].P[i][l] = state->P[i];
+            }
+        }
+        eksblowfish_key_avx2(password[v], group + v * LANES, false);
+        eksblowfish_key_avx2(salt[v], group + v * LANES, true);
+    }
+    for (k = 0; k < rounds; k++) {
+        Blowfish_expand0state_avx2(c, password, vectors);
+        Blowfish_expand0state_avx2(c, salt, vectors);
+    }
+    for (v = 0; v < vectors; v++) {
+        for (l = 0; l < LANES; l++) {
+            blf_ctx *state = &group[v * LANES + l]->state;
+
+            for (i = 0; i < 4 * 256; i++) {
+                state->S[i / 256][i % 256] = c[v].S[i][l];
+            }
+            for (i = 0; i < BLF_N + 2; i++) {
+                state->P[i] = c[v].P[i][l];
+            }
+        }
+    }
+    explicit_bzero(c, sizeof(c));
+    explicit_bzero(password, sizeof(password));
+    explicit_bzero(salt, sizeof(salt));
+}
+
+static void eksblowfish_group_avx2_x8(eksblowfish_lane_t **group, uint32_t rounds)
+{
+    eksblowfish_group_avx2(group, rounds, 1);
+}
+
+static void eksblowfish_group_avx2_x16(eksblowfish_lane_t **group, uint32_t rounds)
+{
+    eksblowfish_group_avx2(group, rounds, 2);
+}
+
+bool eksblowfish_avx2_supported(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+void eksblowfish_expand_avx2_x8(eksblowfish_lane_t **lanes, size_t count)
+{
+    eksblowfish_expand_groups(lanes, count, LANES, eksblowfish_group_avx2_x8, eksblowfish_expand_x4);
+}
+
+void eksblowfish_expand_avx2_x16(eksblowfish_lane_t **lanes, size_t count)
+{
+    eksblowfish_expand_groups(lanes, count, 2 * LANES, eksblowfish_group_avx2_x16, eksblowfish_expand_avx2_x8);
+}
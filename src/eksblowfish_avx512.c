@@ -0,0 +1,246 @@
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include "eksblowfish.h"
+#include "common.h"
+
+/**
+ * 16 lanes EksBlowfish: same lane-major layout as the AVX2 kernel but on
+ * 512-bit vectors. Each lane keeps its own count of remaining rounds so
+ * lanes of different costs can be processed by a same group: a mask
+ * register tracks the lanes which are still running and all the writes
+ * to the states are masked so the completed lanes are left untouched
+ * until the costliest lane of the group is done.
+ *
+ * The x32 variant interleaves the rounds of two independent groups of 16
+ * lanes to hide the latency of the gathers.
+ *
+ * The lane-major contexts (66 KB per group of 16 lanes) are allocated
+ * once per call, on the heap: the threads of the dirty schedulers have
+ * small stacks.
+ */
+
+#define LANES 16
+#define VECTORS_MAX 2
+
+typedef struct {
+    uint32_t S[4 * 256][LANES] __attribute__((aligned(64)));
+    uint32_t P[BLF_N + 2][LANES] __attribute__((aligned(64)));
+} blf_avx512_ctx;
+
+#define LOAD(v) _mm512_load_si512((const void *) (v))
+#define MASK_STORE(v, m, x) _mm512_mask_store_epi32((void *) (v), m, x)
+
+/*
+ * The index of the 32-bit word (b-th entry of the box) for the lane l is
+ * (b * LANES + l): the byte is extracted from x already shifted by 4 then
+ * the lane is or-ed into the 4 lowest bits (0xEA = (A & B) | C).
+ */
+#define GATHER(s, x, shift, lane) \
+    _mm512_i32gather_epi32(_mm512_ternarylogic_epi32(shift(x), _mm512_set1_epi32(0xFF << 4), lane, 0xEA), (const void *) (s), 4)
+
+#define SHIFT0(x) _mm512_srli_epi32(x, 24 - 4)
+#define SHIFT1(x) _mm512_srli_epi32(x, 16 - 4)
+#define SHIFT2(x) _mm512_srli_epi32(x, 8 - 4)
+#define SHIFT3(x) _mm512_slli_epi32(x, 4)
+
+#define F(c, x, lane) \
+    _mm512_add_epi32( \
+        _mm512_xor_si512( \
+            _mm512_add_epi32( \
+                GATHER((c)->S[0x000], x, SHIFT0, lane), \
+                GATHER((c)->S[0x100], x, SHIFT1, lane) \
+            ), \
+            GATHER((c)->S[0x200], x, SHIFT2, lane) \
+        ), \
+        GATHER((c)->S[0x300], x, SHIFT3, lane) \
+    )
+
+// 0x96 = A ^ B ^ C
+#define BLFRND(c, i, j, n, lane) \
+    i = _mm512_ternarylogic_epi32(i, F(c, j, lane), LOAD((c)->P[n]), 0x96)
+
+#define BLFRND_VECTORS(c, i, j, n, lane, vectors) \
+    do { \
+        int _v; \
+        for (_v = 0; _v < (vectors); _v++) \
+            BLFRND(&(c)[_v], (i)[_v], (j)[_v], n, lane); \
+    } while (0)
+
+static inline __attribute__((always_inline)) void Blowfish_encipher_avx512(const blf_avx512_ctx *c, __m512i *xl, __m512i *xr, int vectors)
+{
+    int v;
+    __m512i Xl[VECTORS_MAX], Xr[VECTORS_MAX];
+    const __m512i lane = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+    for (v = 0; v < vectors; v++) {
+        Xl[v] = _mm512_xor_si512(xl[v], LOAD(c[v].P[0]));
+        Xr[v] = xr[v];
+    }
+    BLFRND_VECTORS(c, Xr, Xl, 1, lane, vectors); BLFRND_VECTORS(c, Xl, Xr, 2, lane, vectors);
+    BLFRND_VECTORS(c, Xr, Xl, 3, lane, vectors); BLFRND_VECTORS(c, Xl, Xr, 4, lane, vectors);
+    BLFRND_VECTORS(c, Xr, Xl, 5, lane, vectors); BLFRND_VECTORS(c, Xl, Xr, 6, lane, vectors);
+    BLFRND_VECTORS(c, Xr, Xl, 7, lane, vectors); BLFRND_VECTORS(c, Xl, Xr, 8, lane, vectors);
+    BLFRND_VECTORS(c, Xr, Xl, 9, lane, vectors); BLFRND_VECTORS(c, Xl, Xr, 10, lane, vectors);
+    BLFRND_VECTORS(c, Xr, Xl, 11, lane, vectors); BLFRND_VECTORS(c, Xl, Xr, 12, lane, vectors);
+    BLFRND_VECTORS(c, Xr, Xl, 13, lane, vectors); BLFRND_VECTORS(c, Xl, Xr, 14, lane, vectors);
+    BLFRND_VECTORS(c, Xr, Xl, 15, lane, vectors); BLFRND_VECTORS(c, Xl, Xr, 16, lane, vectors);
+    for (v = 0; v < vectors; v++) {
+        xl[v] = _mm512_xor_si512(Xr[v], LOAD(c[v].P[17]));
+        xr[v] = Xl[v];
+    }
+}
+
+static inline __attribute__((always_inline)) void Blowfish_expand0state_avx512(blf_avx512_ctx *c, __m512i (*key)[BLF_N + 2], const __mmask16 *active, int vectors)
+{
+    int i, v;
+    __m512i datal[VECTORS_MAX], datar[VECTORS_MAX];
+
+    for (v = 0; v < vectors; v++) {
+        for (i = 0; i < BLF_N + 2; i++) {
+            MASK_STORE(c[v].P[i], active[v], _mm512_xor_si512(LOAD(c[v].P[i]), key[v][i]));
+        }
+        datal[v] = datar[v] = _mm512_setzero_si512();
+    }
+    for (i = 0; i < BLF_N + 2; i += 2) {
+        Blowfish_encipher_avx512(c, datal, datar, vectors);
+        for (v = 0; v < vectors; v++) {
+            MASK_STORE(c[v].P[i], active[v], datal[v]);
+            MASK_STORE(c[v].P[i + 1], active[v], datar[v]);
+        }
+    }
+    for (i = 0; i < 4 * 256; i += 2) {
+        Blowfish_encipher_avx512(c, datal, datar, vectors);
+        for (v = 0; v < vectors; v++) {
+            MASK_STORE(c[v].S[i], active[v], datal[v]);
+            MASK_STORE(c[v].S[i + 1], active[v], datar[v]);
+        }
+    }
+}
+
+// transposes the key schedule of each lane into vectors
+static void eksblowfish_key_avx512(__m512i *key, eksblowfish_lane_t **group, bool salt)
+{
+    int i, l;
+    uint32_t transposed[BLF_N + 2][LANES];
+
+    for (l = 0; l < LANES; l++) {
+        const uint32_t *words = salt ? group[l]->salt_key : group[l]->password_key;
+
+        for (i = 0; i < BLF_N + 2; i++) {
+            transposed[i][l] = words[i];
+        }
+    }
+    for (i = 0; i < BLF_N + 2; i++) {
+        key[i] = _mm512_loadu_si512((const void *) transposed[i]);
+    }
+    explicit_bzero(transposed, sizeof(transposed));
+}
+
+static inline __attribute__((always_inline)) void eksblowfish_group_avx512(blf_avx512_ctx *c, eksblowfish_lane_t **group, int vectors)
+{
+    int i, l, v;
+    __mmask16 active[VECTORS_MAX];
+    __m512i rounds[VECTORS_MAX], password[VECTORS_MAX][BLF_N + 2], salt[VECTORS_MAX][BLF_N + 2];
+
+    for (v = 0; v < vectors; v++) {
+        uint32_t remaining[LANES];
+
+        for (l = 0; l < LANES; l++) {
+            const eksblowfish_lane_t *lane = group[v * LANES + l];
+
+            for (i = 0; i < 4 * 256; i++) {
+                c[v].S[i][l] = lane->state.S[i / 256][i % 256];
+            }
+            for (i = 0; i < BLF_N + 2; i++) {
+                c[v].P[i][l] = lane->state.P[i];
+            }
+            remaining[l] = lane->rounds;
+        }
+        rounds[v] = _mm512_loadu_si512((const void *) remaining);
+        eksblowfish_key_avx512(password[v], group + v * LANES, false);
+        eksblowfish_key_avx512(salt[v], group + v * LANES, true);
+    }
+    while (true) {
+        __mmask16 any;
+
+        for (any = 0, v = 0; v < vectors; v++) {
+            active[v] = _mm512_test_epi32_mask(rounds[v], rounds[v]);
+            any |= active[v];
+        }
+        if (0 == any) {
+            break;
+        }
+        Blowfish_expand0state_avx512(c, password, active, vectors);
+        Blowfish_expand0state_avx512(c, salt, active, vectors);
+        for (v = 0; v < vectors; v++) {
+            rounds[v] = _mm512_mask_sub_epi32(rounds[v], active[v], rounds[v], _mm512_set1_epi32(1));
+        }
+    }
+    for (v = 0; v < vectors; v++) {
+        for (l = 0; l < LANES; l++) {
+            eksblowfish_lane_t *lane = group[v * LANES + l];
+
+            for (i = 0; i < 4 * 256; i++) {
+                lane->state.S[i / 256][i % 256] = c[v].S[i][l];
+            }
+            for (i = 0; i < BLF_N + 2; i++) {
+                lane->state.P[i] = c[v].P[i][l];
+            }
+            lane->rounds = 0;
+        }
+    }
+    explicit_bzero(password, sizeof(password));
+    explicit_bzero(salt, sizeof(salt));
+}
+
+static void eksblowfish_expand_avx512(eksblowfish_lane_t **lanes, size_t count, int vectors, eksblowfish_expand_t narrower)
+{
+    size_t i, active;
+    blf_avx512_ctx *c;
+    eksblowfish_lane_t *group[EKSBLOWFISH_LANES_MAX];
+
+    if (0 != posix_memalign((void **) &c, 64, vectors * sizeof(*c))) {
+        narrower(lanes, count);
+        return;
+    }
+    for (i = 0; i < count; /* NOP */) {
+        // gather the next lanes which still have some work to do, whatever their cost
+        for (active = 0; active < (size_t) (vectors * LANES) && i < count; i++) {
+            if (lanes[i]->rounds > 0) {
+                group[active++] = lanes[i];
+            }
+        }
+        if (active < (size_t) (vectors * LANES)) {
+            narrower(group, active);
+            break;
+        }
+        if (1 == vectors) {
+            eksblowfish_group_avx512(c, group, 1);
+        } else {
+            eksblowfish_group_avx512(c, group, 2);
+        }
+    }
+    explicit_bzero(c, vectors * sizeof(*c));
+    free(c);
+}
+
+bool eksblowfish_avx512_supported(void)
+{
+    return __builtin_cpu_supports("avx512f");
+}
+
+void eksblowfish_expand_avx512_x16(eksblowfish_lane_t **lanes, size_t count)
+{
+#ifdef HAVE_EKSBLOWFISH_AVX2
+    eksblowfish_expand_avx512(lanes, count, 1, eksblowfish_expand_avx2_x8);
+#else
+    eksblowfish_expand_avx512(lanes, count, 1, eksblowfish_expand_x4);
+#endif /* HAVE_EKSBLOWFISH_AVX2 */
+}
+
+void eksblowfish_expand_avx512_x32(eksblowfish_lane_t **lanes, size_t count)
+{
+    eksblowfish_expand_avx512(lanes, count, 2, eksblowfish_expand_avx512_x16);
+}
@@ -0,0 +1,192 @@
+#include <string.h>
+
+#include "eksblowfish.h"
+#include "common.h"
+
+/**
+ * 4 lanes EksBlowfish written with the generic vector extension of
+ * GCC/Clang (no intrinsics): 128-bit vectors, which are compiled to SSE2
+ * on x86-64 and to the SIMD instructions of the target elsewhere (NEON,
+ * AltiVec, ...) or to scalar code when it has none.
+ *
+ * Same lane-major layout as the AVX2 kernel but, without a gather
+ * instruction, the indexes of the S-box lookups are computed as vectors
+ * then the 4 words are loaded one by one.
+ *
+ * The x8 variant interleaves the rounds of two independent groups of 4
+ * lanes to hide the latency of the loads.
+ */
+
+#define LANES 4
+#define LANES_SHIFT 2
+#define VECTORS_MAX 2
+
+typedef uint32_t v4u32 __attribute__((vector_size(LANES * sizeof(uint32_t))));
+
+typedef struct {
+    v4u32 S[4 * 256];
+    v4u32 P[BLF_N + 2];
+} blf_vector_ctx;
+
+static inline __attribute__((always_inline)) v4u32 gather(const v4u32 *s, v4u32 index)
+{
+    const uint32_t *words = (const uint32_t *) s;
+
+    return (v4u32) { words[index[0]], words[index[1]], words[index[2]], words[index[3]] };
+}
+
+/*
+ * The index of the 32-bit word (b-th entry of the box) for the lane l is
+ * (b * LANES + l): the byte is directly extracted already shifted by 2
+ * from x and the lane is or-ed into the 2 lowest bits.
+ */
+#define GATHER(s, x, shift, lane) \
+    gather(s, (shift(x) & (0xFF << LANES_SHIFT)) | (lane))
+
+#define SHIFT0(x) ((x) >> (24 - LANES_SHIFT))
+#define SHIFT1(x) ((x) >> (16 - LANES_SHIFT))
+#define SHIFT2(x) ((x) >> (8 - LANES_SHIFT))
+#define SHIFT3(x) ((x) << LANES_SHIFT)
+
+#define F(c, x, lane) \
+    (((GATHER(&(c)->S[0x000], x, SHIFT0, lane) \
+    + GATHER(&(c)->S[0x100], x, SHIFT1, lane)) \
+    ^ GATHER(&(c)->S[0x200], x, SHIFT2, lane)) \
+    + GATHER(&(c)->S[0x300], x, SHIFT3, lane))
+
+#define BLFRND(c, i, j, n, lane) \
+    i ^= F(c, j, lane) ^ (c)->P[n]
+
+#define BLFRND_VECTORS(c, i, j, n, lane, vectors) \
+    do { \
+        int _v; \
+        for (_v = 0; _v < (vectors); _v++) \
+            BLFRND(&(c)[_v], (i)[_v], (j)[_v], n, lane); \
+    } while (0)
+
+static inline __attribute__((always_inline)) void Blowfish_encipher_vector(const blf_vector_ctx *c, v4u32 *xl, v4u32 *xr, int vectors)
+{
+    int v;
+    v4u32 Xl[VECTORS_MAX], Xr[VECTORS_MAX];
+    const v4u32 lane = { 0, 1, 2, 3 };
+
+    for (v = 0; v < vectors; v++) {
+        Xl[v] = xl[v] ^ c[v].P[0];
+        Xr[v] = xr[v];
+    }
+    BLFRND_VECTORS(c, Xr, Xl, 1, lane, vectors); BLFRND_VECTORS(c, Xl, Xr, 2, lane, vectors);
+    BLFRND_VECTORS(c, Xr, Xl, 3, lane, vectors); BLFRND_VECTORS(c, Xl, Xr, 4, lane, vectors);
+    BLFRND_VECTORS(c, Xr, Xl, 5, lane, vectors); BLFRND_VECTORS(c, Xl, Xr, 6, lane, vectors);
+    BLFRND_VECTORS(c, Xr, Xl, 7, lane, vectors); BLFRND_VECTORS(c, Xl, Xr, 8, lane, vectors);
+    BLFRND_VECTORS(c, Xr, Xl, 9, lane, vectors); BLFRND_VECTORS(c, Xl, Xr, 10, lane, vectors);
+    BLFRND_VECTORS(c, Xr, Xl, 11, lane, vectors); BLFRND_VECTORS(c, Xl, Xr, 12, lane, vectors);
+    BLFRND_VECTORS(c, Xr, Xl, 13, lane, vectors); BLFRND_VECTORS(c, Xl, Xr, 14, lane, vectors);
+    BLFRND_VECTORS(c, Xr, Xl, 15, lane, vectors); BLFRND_VECTORS(c, Xl, Xr, 16, lane, vectors);
+    for (v = 0; v < vectors; v++) {
+        xl[v] = Xr[v] ^ c[v].P[17];
+        xr[v] = Xl[v];
+    }
+}
+
+static inline __attribute__((always_inline)) void Blowfish_expand0state_vector(blf_vector_ctx *c, v4u32 (*key)[BLF_N + 2], int vectors)
+{
+    int i, v;
+    v4u32 datal[VECTORS_MAX], datar[VECTORS_MAX];
+
+    for (v = 0; v < vectors; v++) {
+        for (i = 0; i < BLF_N + 2; i++) {
+            c[v].P[i] ^= key[v][i];
+        }
+        datal[v] = datar[v] = (v4u32) { 0, 0, 0, 0 };
+    }
+    for (i = 0; i < BLF_N + 2; i += 2) {
+        Blowfish_encipher_vector(c, datal, datar, vectors);
+        for (v = 0; v < vectors; v++) {
+            c[v].P[i] = datal[v];
+            c[v].P[i + 1] = datar[v];
+        }
+    }
+    for (i = 0; i < 4 * 256; i += 2) {
+        Blowfish_encipher_vector(c, datal, datar, vectors);
+        for (v = 0; v < vectors; v++) {
+            c[v].S[i] = datal[v];
+            c[v].S[i + 1] = datar[v];
+        }
+    }
+}
+
+// transposes the key schedule of each lane into vectors
+static void eksblowfish_key_vector(v4u32 *key, eksblowfish_lane_t **group, bool salt)
+{
+    int i, l;
+
+    for (l = 0; l < LANES; l++) {
+        const uint32_t *words = salt ? group[l]->salt_key : group[l]->password_key;
+
+        for (i = 0; i < BLF_N + 2; i++) {
+            key[i][l] = words[i];
+        }
+    }
+}
+
+static inline __attribute__((always_inline)) void eksblowfish_group_vector(eksblowfish_lane_t **group, uint32_t rounds, int vectors)
+{
+    int i, l, v;
+    uint32_t k;
+    blf_vector_ctx c[VECTORS_MAX];
+    v4u32 password[VECTORS_MAX][BLF_N + 2], salt[VECTORS_MAX][BLF_N + 2];
+
+    for (v = 0; v < vectors; v++) {
+        for (l = 0; l < LANES; l++) {
+            const blf_ctx *state = &group[v * LANES + l]->state;
+
+            for (i = 0; i < 4 * 256; i++) {
+                c[v].S[i][l] = state->S[i / 256][i % 256];
+            }
+            for (i = 0; i < BLF_N + 2; i++) {
+                c[v].P[i][l] = state->P[i];
+            }
+        }
+        eksblowfish_key_vector(password[v], group + v * LANES, false);
+        eksblowfish_key_vector(salt[v], group + v * LANES, true);
+    }
+    for (k = 0; k < rounds; k++) {
+        Blowfish_expand0state_vector(c, password, vectors);
+        Blowfish_expand0state_vector(c, salt, vectors);
+    }
+    for (v = 0; v < vectors; v++) {
+        for (l = 0; l < LANES; l++) {
+            blf_ctx *state = &group[v * LANES + l]->state;
+
+            for (i = 0; i < 4 * 256; i++) {
+                state->S[i / 256][i % 256] = c[v].S[i][l];
+            }
+            for (i = 0; i < BLF_N + 2; i++) {
+                state->P[i] = c[v].P[i][l];
+            }
+        }
+    }
+    explicit_bzero(c, sizeof(c));
+    explicit_bzero(password, sizeof(password));
+    explicit_bzero(salt, sizeof(salt));
+}
+
+static void eksblowfish_group_vector_x4(eksblowfish_lane_t **group, uint32_t rounds)
+{
+    eksblowfish_group_vector(group, rounds, 1);
+}
+
+static void eksblowfish_group_vector_x8(eksblowfish_lane_t **group, uint32_t rounds)
+{
+    eksblowfish_group_vector(group, rounds, 2);
+}
+
+void eksblowfish_expand_vector_x4(eksblowfish_lane_t **lanes, size_t count)
+{
+    eksblowfish_expand_groups(lanes, count, LANES, eksblowfish_group_vector_x4, eksblowfish_expand_x2);
+}
+
+void eksblowfish_expand_vector_x8(eksblowfish_lane_t **lanes, size_t count)
+{
+    eksblowfish_expand_groups(lanes, count, 2 * LANES, eksblowfish_group_vector_x8, eksblowfish_expand_vector_x4);
+}
@@ -0,0 +1,40 @@
+/*
+ * getentropy for the systems which lack it: reads /dev/urandom.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define DEF_WEAK(symbol) \
+    /* NOP */
+
+int getentropy(void *buf, size_t len)
+{
+    int fd;
+    ssize_t r;
+    size_t done;
+
+    if (len > 256) {
+        errno = EIO;
+        return -1;
+    }
+    if (-1 == (fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC))) {
+        return -1;
+    }
+    for (done = 0; done < len; done += r) {
+        if ((r = read(fd, (char *) buf + done, len - done)) <= 0) {
+            if (-1 == r && EINTR == errno) {
+                r = 0;
+                continue;
+            }
+            close(fd);
+            errno = EIO;
+            return -1;
+        }
+    }
+    close(fd);
+
+    return 0;
+}
+DEF_WEAK(getentropy);
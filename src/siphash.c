@@ -0,0 +1,83 @@
+#include "siphash.h"
+
+#define ROTL(x, b) \
+    (uint64_t) (((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND \
+    do { \
+        v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32); \
+        v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2; \
+        v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0; \
+        v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32); \
+    } while (0)
+
+static uint64_t load64_le(const uint8_t *p)
+{
+    return
+           ((uint64_t) p[0])
+        | (((uint64_t) p[1]) << 8)
+        | (((uint64_t) p[2]) << 16)
+        | (((uint64_t) p[3]) << 24)
+        | (((uint64_t) p[4]) << 32)
+        | (((uint64_t) p[5]) << 40)
+        | (((uint64_t) p[6]) << 48)
+        | (((uint64_t) p[7]) << 56)
+    ;
+}
+
+static void store64_le(uint8_t *p, uint64_t v)
+{
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        p[i] = (uint8_t) (v >> (8 * i));
+    }
+}
+
+void siphash128(const uint8_t key[SIPHASH_KEY_SIZE], const uint8_t *data, size_t data_len, uint8_t out[SIPHASH_128_SIZE])
+{
+    int i;
+    size_t left;
+    uint64_t m, b, k0, k1, v0, v1, v2, v3;
+    const uint8_t *end = data + data_len - (data_len % 8);
+
+    k0 = load64_le(key);
+    k1 = load64_le(key + 8);
+    v0 = UINT64_C(0x736f6d6570736575) ^ k0;
+    v1 = UINT64_C(0x646f72616e646f6d) ^ k1;
+    v2 = UINT64_C(0x6c7967656e657261) ^ k0;
+    v3 = UINT64_C(0x7465646279746573) ^ k1;
+    // 128-bit output
+    v1 ^= 0xee;
+
+    for (/* NOP */; data != end; data += 8) {
+        m = load64_le(data);
+        v3 ^= m;
+        SIPROUND;
+        SIPROUND;
+        v0 ^= m;
+    }
+    b = ((uint64_t) data_len) << 56;
+    left = data_len & 7;
+    for (i = left - 1; i >= 0; i--) {
+        b |= ((uint64_t) data[i]) << (8 * i);
+    }
+    v3 ^= b;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= b;
+
+    v2 ^= 0xee;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    store64_le(out, v0 ^ v1 ^ v2 ^ v3);
+
+    v1 ^= 0xdd;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    store64_le(out + 8, v0 ^ v1 ^ v2 ^ v3);
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SIPHASH_KEY_SIZE 16
+#define SIPHASH_128_SIZE 16
+
+/**
+ * SipHash-2-4 (Aumasson & Bernstein), a PRF keyed by a secret
+ * *key*: the 128-bit variant of *data* is written into *out*.
+ */
+void siphash128(const uint8_t key[SIPHASH_KEY_SIZE], const uint8_t *data, size_t data_len, uint8_t out[SIPHASH_128_SIZE]);
@@ -6,6 +6,8 @@
 #include <inttypes.h>
 
 #include "common.h"
+#include "eksblowfish.h"
+#include "siphash.h"
 #include "unity.h"
 
 #define MAX_RAW_SALT_LEN BCRYPT_MAXSALT
@@ -15,8 +17,15 @@ extern uint8_t *encode_base64(const uint8_t *data, const uint8_t * const data_en
 extern uint8_t *decode_base64(const uint8_t *data, const uint8_t * const data_end, uint8_t *buffer, const uint8_t * const buffer_end);
 
 extern uint8_t *bcrypt_init_salt(int minor, int cost, const uint8_t *raw_salt, const uint8_t * const raw_salt_end, uint8_t *buffer, const uint8_t * const buffer_end);
+extern int bcrypt_inspect_hash(const uint8_t *hash);
 extern const uint8_t *bcrypt_full_parse_hash(const uint8_t *salt, const uint8_t *salt_end, int *minor, int *cost, uint8_t *raw_salt, const uint8_t * const raw_salt_end);
 extern uint8_t *bcrypt_hash(const uint8_t *password, const uint8_t * const password_end, const uint8_t *salt, const uint8_t * const salt_end, uint8_t *hash, const uint8_t * const hash_end);
+#ifdef HAVE_LIBXCRYPT
+extern uint8_t *bcrypt_hash_libxcrypt(const uint8_t *password, const uint8_t * const password_end, const uint8_t *salt, const uint8_t * const salt_end, uint8_t *hash, const uint8_t * const hash_end);
+#endif /* HAVE_LIBXCRYPT */
+extern bool bcrypt_hash_many(const uint8_t * const *passwords, const uint8_t * const *salts, uint8_t *hashes, bool *computed, size_t count);
+extern const char *bcrypt_backend(void);
+extern void bcrypt_select_backend(void);
 
 #define D(e, r) { .raw = (const uint8_t *) r, .raw_size = STR_LEN(r), .encoded = (const uint8_t *) e, .encoded_size = STR_LEN(e) }
 
@@ -275,6 +284,35 @@ void encode_base64_non_3_group_truncation_test(void)
     }
 }
 
+/* ==================== SipHash ==================== */
+
+void siphash128_known_vectors_test(void)
+{
+    size_t j;
+    uint8_t key[SIPHASH_KEY_SIZE], data[64], out[SIPHASH_128_SIZE];
+    // reference vectors of SipHash-2-4-128: key = 00 01 .. 0f, data = 00 01 .. (length - 1)
+    const struct {
+        size_t length;
+        const char *expected;
+    } vectors[] = {
+        { 0, "\xa3\x81\x7f\x04\xba\x25\xa8\xe6\x6d\xf6\x72\x14\xc7\x55\x02\x93" },
+        { 1, "\xda\x87\xc1\xd8\x6b\x99\xaf\x44\x34\x76\x59\x11\x9b\x22\xfc\x45" },
+        { 2, "\x81\x77\x22\x8d\xa4\xa4\x5d\xc7\xfc\xa3\x8b\xde\xf6\x0a\xff\xe4" },
+        { 63, "\x51\x50\xd1\x77\x2f\x50\x83\x4a\x50\x3e\x06\x9a\x97\x3f\xbd\x7c" },
+    };
+
+    for (j = 0; j < ARRAY_SIZE(key); j++) {
+        key[j] = j;
+    }
+    for (j = 0; j < ARRAY_SIZE(data); j++) {
+        data[j] = j;
+    }
+    for (i = 0; i < ARRAY_SIZE(vectors); i++) {
+        siphash128(key, data, vectors[i].length, out);
+        TEST_ASSERT_EQUAL_MEMORY(vectors[i].expected, out, SIPHASH_128_SIZE);
+    }
+}
+
 /* ==================== bcrypt hashing ==================== */
 
 #define E(k, c, s, h) \
@@ -387,6 +425,8 @@ static const test_vector_t vectors[] = {
     E("U*U*", 5, "CCCCCCCCCCCCCCCCCCCCC.", "$2a$05$CCCCCCCCCCCCCCCCCCCCC.VGOzA784oUp/Z0DY336zx7pLYAy0lwK"),
     E("U*U*U", 5, "XXXXXXXXXXXXXXXXXXXXXO", "$2a$05$XXXXXXXXXXXXXXXXXXXXXOAcXxm9kjPGEMsLznoKqmqw7tc8WCx4a"),
     E("", 6, "DCq7YPn5Rq63x1Lad4cll.", "$2a$06$DCq7YPn5Rq63x1Lad4cll.TV4S6ytwfsfvkgY8jIucDrjc8deX1s."),
+    // 8-bit characters: the "sign extension" countermeasure of crypt_blowfish changes this one for $2a$
+    E("\xff\xa3" "34" "\xff\xff\xff\xa3" "345", 5, "/OK.fbVrR/bpIqNJ5ianF.", "$2a$05$/OK.fbVrR/bpIqNJ5ianF.o./n25XVfn6oAPaUvHe.Csk4zRfsYPi"),
     // see: https://bitbucket.org/vadim/bcrypt.net/src/464c41416dc9/BCrypt.Net.Test/TestBCrypt.cs?fileviewer=file-view-default
     E("", 8, "HqWuK6/Ng6sg9gQzbLrgb.", "$2a$08$HqWuK6/Ng6sg9gQzbLrgb.Tl.ZHfXLhvt/SgVyWhQqgqcZ7ZuUtye"),
     E("", 10, "k1wbIrmNyFAPwPVPSVa/ze", "$2a$10$k1wbIrmNyFAPwPVPSVa/zecw2BCEnBwVS2GbrmgzxFUOqW9dk4TCW"),
@@ -447,6 +487,92 @@ void bcrypt_known_vectors_test(void)
     }
 }
 
+void bcrypt_inspect_hash_test(void)
+{
+    size_t j;
+    uint8_t hash[BCRYPT_HASHSPACE - 1];
+    const char * const invalid[] = {
+        "$2c$05$CCCCCCCCCCCCCCCCCCCCC.E5YPO9kmyuRGyh0XouQYb4YMJKvyOeW", // unknown minor
+        "$2a$5$CCCCCCCCCCCCCCCCCCCCC.E5YPO9kmyuRGyh0XouQYb4YMJKvyOeWx", // one digit cost
+        "$2a$03$CCCCCCCCCCCCCCCCCCCCC.E5YPO9kmyuRGyh0XouQYb4YMJKvyOeW", // cost too low
+        "$2a$32$CCCCCCCCCCCCCCCCCCCCC.E5YPO9kmyuRGyh0XouQYb4YMJKvyOeW", // cost too high
+        "$2a$05$CCCCCCCCCCCCCCCCCCCCC.E5YPO9kmyuRGyh0XouQYb4YMJKvyOe+", // not in the alphabet
+        "$2a$05$CCCCCCCCCCCCCCCCCCCCC.E5YPO9kmyuRGyh0XouQYb4YMJKvyOeX", // unused bits of the digest
+        "$2a$05$CCCCCCCCCCCCCCCCCCCCCAE5YPO9kmyuRGyh0XouQYb4YMJKvyOeW", // unused bits of the salt
+        "$2a$05$CCCCCCCCCC\0CCCCCCCCCC.E5YPO9kmyuRGyh0XouQYb4YMJKvyOe",
+    };
+
+    for (i = 0; i < ARRAY_SIZE(vectors); i++) {
+        TEST_ASSERT_EQUAL_INT(vectors[i].cost, bcrypt_inspect_hash(vectors[i].hash));
+    }
+    TEST_ASSERT_EQUAL_INT(5, bcrypt_inspect_hash((const uint8_t *) "$2y$05$CCCCCCCCCCCCCCCCCCCCC.E5YPO9kmyuRGyh0XouQYb4YMJKvyOeW"));
+    for (j = 0; j < ARRAY_SIZE(invalid); j++) {
+        TEST_ASSERT_EQUAL_INT(0, bcrypt_inspect_hash((const uint8_t *) invalid[j]));
+    }
+    // every character of the salt and the digest, one at a time
+    memcpy(hash, "$2b$31$CCCCCCCCCCCCCCCCCCCCC.E5YPO9kmyuRGyh0XouQYb4YMJKvyOeW", STR_SIZE(hash));
+    TEST_ASSERT_EQUAL_INT(31, bcrypt_inspect_hash(hash));
+    for (j = STR_LEN("$vm$cc$"); j < STR_SIZE(hash); j++) {
+        uint8_t c = hash[j];
+
+        hash[j] = '$';
+        TEST_ASSERT_EQUAL_INT(0, bcrypt_inspect_hash(hash));
+        hash[j] = c;
+    }
+}
+
+void bcrypt_hash_many_test(void)
+{
+    size_t count;
+    bool computed[ARRAY_SIZE(vectors) + 1];
+    uint8_t hashes[ARRAY_SIZE(vectors) + 1][BCRYPT_HASHSPACE - 1];
+    const uint8_t *passwords[ARRAY_SIZE(vectors) + 1], *salts[ARRAY_SIZE(vectors) + 1];
+
+    // the cheapest vectors, mixing their costs, then an invalid salt
+    for (count = i = 0; i < ARRAY_SIZE(vectors); i++) {
+        if (vectors[i].cost <= 8) {
+            passwords[count] = vectors[i].password;
+            salts[count] = vectors[i].hash;
+            ++count;
+        }
+    }
+    passwords[count] = (const uint8_t *) "U*U";
+    salts[count] = (const uint8_t *) "$2c$05$CCCCCCCCCCCCCCCCCCCCC.";
+    ++count;
+    TEST_ASSERT_TRUE(bcrypt_hash_many(passwords, salts, (uint8_t *) hashes, computed, count));
+    for (i = 0; i < count - 1; i++) {
+        TEST_ASSERT_TRUE(computed[i]);
+        TEST_ASSERT_EQUAL_MEMORY(salts[i], hashes[i], STR_SIZE(hashes[i]));
+    }
+    TEST_ASSERT_FALSE(computed[count - 1]);
+}
+
+void bcrypt_libxcrypt_known_vectors_test(void)
+{
+#ifdef HAVE_LIBXCRYPT
+    uint8_t hash[BCRYPT_HASHSPACE - 1];
+    const uint8_t * const hash_end = hash + STR_SIZE(hash);
+
+    for (i = 0; i < ARRAY_SIZE(vectors); i++) {
+        erase_buffer(hash, hash_end);
+        p = bcrypt_hash_libxcrypt(vectors[i].password, vectors[i].password_end, vectors[i].hash, vectors[i].hash_end, hash, hash_end);
+        TEST_ASSERT_NOT_NULL(p);
+        TEST_ASSERT_EQUAL_PTR(hash_end, p);
+        TEST_ASSERT_EQUAL_MEMORY(vectors[i].hash, hash, STR_SIZE(hash));
+    }
+#else
+    TEST_IGNORE_MESSAGE("libxcrypt backend not built");
+#endif /* HAVE_LIBXCRYPT */
+}
+
+void bcrypt_select_backend_test(void)
+{
+    bcrypt_select_backend();
+    TEST_ASSERT_NOT_NULL(bcrypt_backend());
+    // the selected backend has to give the same results
+    bcrypt_known_vectors_test();
+}
+
 // password truncation to 72 bytes
 void bcrypt_hash_72th_key_truncation_test(void)
 {
@@ -521,6 +647,192 @@ void bcrypt_hash_72th_key_truncation_test_bis(void)
     }
 }
 
+/* ==================== EksBlowfish kernels ==================== */
+
+// kernels are checked against the vectors up to this cost (to keep the test suite fast)
+#define KERNEL_MAX_COST 8
+
+static void check_expand_kernel(eksblowfish_expand_t expand)
+{
+    size_t j, count;
+    static uint8_t raw_salts[ARRAY_SIZE(vectors)][MAX_RAW_SALT_LEN];
+    static eksblowfish_lane_t states[ARRAY_SIZE(vectors)], *lanes[ARRAY_SIZE(vectors)];
+    uint8_t ciphertext[4 * BCRYPT_WORDS], encoded[BCRYPT_HASHSPACE - 1 - BCRYPT_SALTSPACE];
+
+    for (count = i = 0; i < ARRAY_SIZE(vectors); i++) {
+        int minor, cost;
+
+        if (vectors[i].cost > KERNEL_MAX_COST) {
+            continue;
+        }
+        p = bcrypt_full_parse_hash(vectors[i].hash, vectors[i].hash_end, &minor, &cost, raw_salts[count], raw_salts[count] + MAX_RAW_SALT_LEN);
+        TEST_ASSERT_NOT_NULL(p);
+        eksblowfish_setup(&states[count], vectors[i].password, vectors[i].password_size, raw_salts[count], cost);
+        lanes[count] = &states[count];
+        ++count;
+    }
+    expand(lanes, count);
+    for (count = i = 0; i < ARRAY_SIZE(vectors); i++) {
+        uint32_t cdata[BCRYPT_WORDS];
+
+        if (vectors[i].cost > KERNEL_MAX_COST) {
+            continue;
+        }
+        TEST_ASSERT_EQUAL_UINT32(0, states[count].rounds);
+        eksblowfish_finalize(&states[count], cdata);
+        for (j = 0; j < BCRYPT_WORDS; j++) {
+            ciphertext[4 * j + 0] = cdata[j] >> 24;
+            ciphertext[4 * j + 1] = cdata[j] >> 16;
+            ciphertext[4 * j + 2] = cdata[j] >> 8;
+            ciphertext[4 * j + 3] = cdata[j];
+        }
+        p = encode_base64(ciphertext, ciphertext + STR_LEN(ciphertext), encoded, encoded + STR_SIZE(encoded));
+        TEST_ASSERT_EQUAL_PTR(encoded + STR_SIZE(encoded), p);
+        TEST_ASSERT_EQUAL_MEMORY(vectors[i].hash + BCRYPT_SALTSPACE, encoded, STR_SIZE(encoded));
+        ++count;
+    }
+}
+
+void eksblowfish_expand_x1_test(void)
+{
+    check_expand_kernel(eksblowfish_expand_x1);
+}
+
+void eksblowfish_expand_x2_test(void)
+{
+    check_expand_kernel(eksblowfish_expand_x2);
+}
+
+void eksblowfish_expand_x4_test(void)
+{
+    check_expand_kernel(eksblowfish_expand_x4);
+}
+
+void eksblowfish_expand_vector_test(void)
+{
+#ifdef HAVE_EKSBLOWFISH_VECTOR
+    check_expand_kernel(eksblowfish_expand_vector_x4);
+    check_expand_kernel(eksblowfish_expand_vector_x8);
+#else
+    TEST_IGNORE_MESSAGE("vector kernel not built");
+#endif /* HAVE_EKSBLOWFISH_VECTOR */
+}
+
+void eksblowfish_expand_avx2_test(void)
+{
+#ifdef HAVE_EKSBLOWFISH_AVX2
+    if (!eksblowfish_avx2_supported()) {
+        TEST_IGNORE_MESSAGE("AVX2 is not supported by this CPU");
+    }
+    check_expand_kernel(eksblowfish_expand_avx2_x8);
+    check_expand_kernel(eksblowfish_expand_avx2_x16);
+#else
+    TEST_IGNORE_MESSAGE("AVX2 kernel not built");
+#endif /* HAVE_EKSBLOWFISH_AVX2 */
+}
+
+void eksblowfish_expand_avx512_test(void)
+{
+#ifdef HAVE_EKSBLOWFISH_AVX512
+    if (!eksblowfish_avx512_supported()) {
+        TEST_IGNORE_MESSAGE("AVX-512 is not supported by this CPU");
+    }
+    check_expand_kernel(eksblowfish_expand_avx512_x16);
+    check_expand_kernel(eksblowfish_expand_avx512_x32);
+#else
+    TEST_IGNORE_MESSAGE("AVX-512 kernel not built");
+#endif /* HAVE_EKSBLOWFISH_AVX512 */
+}
+
+typedef struct {
+    size_t queued, completed;
+    size_t vector[ARRAY_SIZE(vectors)];
+    uint8_t raw_salts[ARRAY_SIZE(vectors)][MAX_RAW_SALT_LEN];
+    eksblowfish_lane_t states[ARRAY_SIZE(vectors)];
+} schedule_test_t;
+
+static eksblowfish_lane_t *schedule_test_next(void *data)
+{
+    schedule_test_t *queue = data;
+
+    return queue->queued < ARRAY_SIZE(queue->states) && queue->states[queue->queued].rounds > 0 ? &queue->states[queue->queued++] : NULL;
+}
+
+static void schedule_test_done(eksblowfish_lane_t *lane, void *data)
+{
+    size_t j, v;
+    uint32_t cdata[BCRYPT_WORDS];
+    schedule_test_t *queue = data;
+    uint8_t ciphertext[4 * BCRYPT_WORDS], encoded[BCRYPT_HASHSPACE - 1 - BCRYPT_SALTSPACE];
+
+    TEST_ASSERT_EQUAL_UINT32(0, lane->rounds);
+    v = queue->vector[lane - queue->states];
+    eksblowfish_finalize(lane, cdata);
+    for (j = 0; j < BCRYPT_WORDS; j++) {
+        ciphertext[4 * j + 0] = cdata[j] >> 24;
+        ciphertext[4 * j + 1] = cdata[j] >> 16;
+        ciphertext[4 * j + 2] = cdata[j] >> 8;
+        ciphertext[4 * j + 3] = cdata[j];
+    }
+    encode_base64(ciphertext, ciphertext + STR_LEN(ciphertext), encoded, encoded + STR_SIZE(encoded));
+    TEST_ASSERT_EQUAL_MEMORY(vectors[v].hash + BCRYPT_SALTSPACE, encoded, STR_SIZE(encoded));
+    ++queue->completed;
+}
+
+void eksblowfish_schedule_test(void)
+{
+    size_t l, count;
+    static schedule_test_t queue;
+    eksblowfish_utilization_t utilization = { 0 };
+
+    // mixed costs, in the order of the vectors
+    memset(&queue, 0, sizeof(queue));
+    for (count = i = 0; i < ARRAY_SIZE(vectors); i++) {
+        int minor, cost;
+
+        if (vectors[i].cost > KERNEL_MAX_COST) {
+            continue;
+        }
+        p = bcrypt_full_parse_hash(vectors[i].hash, vectors[i].hash_end, &minor, &cost, queue.raw_salts[count], queue.raw_salts[count] + MAX_RAW_SALT_LEN);
+        TEST_ASSERT_NOT_NULL(p);
+        eksblowfish_setup(&queue.states[count], vectors[i].password, vectors[i].password_size, queue.raw_salts[count], cost);
+        queue.vector[count] = i;
+        ++count;
+    }
+    eksblowfish_schedule(schedule_test_next, schedule_test_done, &queue, &utilization);
+    TEST_ASSERT_EQUAL_size_t(count, queue.queued);
+    TEST_ASSERT_EQUAL_size_t(count, queue.completed);
+    TEST_ASSERT_EQUAL_size_t(eksblowfish_kernel()->lanes, utilization.lanes);
+    TEST_ASSERT_TRUE(utilization.elapsed > 0);
+    for (l = 0; l < utilization.lanes; l++) {
+        TEST_ASSERT_TRUE(utilization.busy[l] <= utilization.elapsed);
+    }
+}
+
+void eksblowfish_autotune_test(void)
+{
+    size_t i;
+    const eksblowfish_kernel_t *selected;
+
+    // a second call measures the kernel selected by the first one again like the others
+    eksblowfish_autotune();
+    eksblowfish_autotune();
+    selected = eksblowfish_kernel();
+    TEST_ASSERT_TRUE(eksblowfish_kernel_supported(selected));
+    for (i = 0; i < eksblowfish_kernel_count(); i++) {
+        const eksblowfish_kernel_t *kernel = eksblowfish_kernel_at(i);
+
+        if (eksblowfish_kernel_supported(kernel)) {
+            TEST_ASSERT_TRUE(kernel->rate > 0.0);
+            TEST_ASSERT_TRUE(kernel->rate <= selected->rate);
+        } else {
+            TEST_ASSERT_EQUAL_DOUBLE(0.0, kernel->rate);
+        }
+    }
+    TEST_ASSERT_NULL(eksblowfish_kernel_at(eksblowfish_kernel_count()));
+    check_expand_kernel(eksblowfish_expand);
+}
+
 int main(void)
 {
     UNITY_BEGIN();
@@ -540,10 +852,24 @@ int main(void)
     RUN_TEST(encode_base64_normal_case_without_additional_space_but_null_terminated_test);
     RUN_TEST(encode_base64_output_buffer_too_small_test);
     RUN_TEST(encode_base64_non_3_group_truncation_test);
+    RUN_TEST(siphash128_known_vectors_test);
     UNITY_PRINT_EOL();
     RUN_TEST(bcrypt_known_vectors_test);
     RUN_TEST(bcrypt_hash_72th_key_truncation_test);
     RUN_TEST(bcrypt_hash_72th_key_truncation_test_bis);
+    RUN_TEST(bcrypt_inspect_hash_test);
+    RUN_TEST(bcrypt_libxcrypt_known_vectors_test);
+    RUN_TEST(bcrypt_select_backend_test);
+    UNITY_PRINT_EOL();
+    RUN_TEST(eksblowfish_expand_x1_test);
+    RUN_TEST(eksblowfish_expand_x2_test);
+    RUN_TEST(eksblowfish_expand_x4_test);
+    RUN_TEST(eksblowfish_expand_vector_test);
+    RUN_TEST(eksblowfish_expand_avx2_test);
+    RUN_TEST(eksblowfish_expand_avx512_test);
+    RUN_TEST(eksblowfish_autotune_test);
+    RUN_TEST(eksblowfish_schedule_test);
+    RUN_TEST(bcrypt_hash_many_test);
 
     return UNITY_END();
 }
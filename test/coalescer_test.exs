@@ -0,0 +1,88 @@
+defmodule ExPassword.Bcrypt.CoalescerTest do
+  use ExUnit.Case
+
+  alias ExPassword.Bcrypt.Coalescer
+
+  @pairs [
+    {"", "$2y$04$35MAXYSjPyfzANk1PE4jpe6BFtSTc3m125J3MsT9LfMAmKsxH.DIu"},
+    {"password", "$2y$04$5LEzpJFJbsVLiAPtunma.eWxP0D4CvNd5fw4cV9wT3cSCO.5oG4iO"},
+    {"", "$2y$04$5LEzpJFJbsVLiAPtunma.eWxP0D4CvNd5fw4cV9wT3cSCO.5oG4iO"},
+    {"password", "$2y$04$GQ8fkszdqnITr1NAbV373egWUmXr7pSPDCV7OaJ1r0ftWsM5ALnOW"},
+  ]
+
+  # slow enough (cost 13) to be still running while other requests are sent
+  @slow {"password", "$2b$13$tqXDqiqqiD1XjFa/lOQ2/.mOueESdYsCzyQ3tmkFLIpFtLN1KBqCS"}
+
+  defp verify_async({password, hash}) do
+    Task.async(fn -> ExPassword.Bcrypt.verify?(password, hash) end)
+  end
+
+  defp await_pending(count) do
+    if count != :sys.get_state(Coalescer).count do
+      Process.sleep(1)
+      await_pending(count)
+    end
+  end
+
+  defp running_batches do
+    case Map.keys(:sys.get_state(Coalescer).running) do
+      [] ->
+        Process.sleep(1)
+        running_batches()
+      pids ->
+        pids
+    end
+  end
+
+  describe "ExPassword.Bcrypt.Coalescer" do
+    test "runs a request at once when no batch is running" do
+      start_supervised!({Coalescer, max_batch: 16})
+      assert Coalescer.running?()
+
+      assert true == ExPassword.Bcrypt.verify?("password", "$2y$04$5LEzpJFJbsVLiAPtunma.eWxP0D4CvNd5fw4cV9wT3cSCO.5oG4iO")
+      assert %{batches: 1, requests: 1, fill_ratio: 0.0625} = Coalescer.stats()
+    end
+
+    test "coalesces the calls to verify?/2 received while a batch is running" do
+      start_supervised!({Coalescer, max_batch: 16})
+      slow = verify_async(@slow)
+      running_batches()
+      tasks = Enum.map(@pairs, &verify_async/1)
+      await_pending(length(@pairs))
+
+      assert [true, true, false, true] == Enum.map(tasks, &Task.await(&1, :infinity))
+      assert true == Task.await(slow, :infinity)
+      assert %{batches: 2, requests: 5, max_batch: 16} = Coalescer.stats()
+    end
+
+    test "does not hold back a full batch" do
+      start_supervised!({Coalescer, max_batch: 4})
+      slow = verify_async(@slow)
+      running_batches()
+
+      assert [true, true, false, true] == @pairs |> Enum.map(&verify_async/1) |> Enum.map(&Task.await(&1, :infinity))
+      assert nil == Task.yield(slow, 0)
+      assert true == Task.await(slow, :infinity)
+      assert %{batches: 2, requests: 5, max_batch: 4, fill_ratio: 0.625} = Coalescer.stats()
+    end
+
+    test "runs the batch again when its process dies" do
+      start_supervised!(Coalescer)
+      task = Task.async(fn -> ExPassword.Bcrypt.verify?("password", "$2b$12$UemS.UQXRUBsB2SYVAjfBul9cOweeXVOrrJGbMXJ93zZxxjVU1XXC") end)
+      [pid] = running_batches()
+      Process.exit(pid, :kill)
+
+      assert true == Task.await(task, :infinity)
+      assert %{batches: 1, requests: 1} = Coalescer.stats()
+      assert %{} == :sys.get_state(Coalescer).running
+    end
+
+    test "still raises on invalid hashes" do
+      start_supervised!(Coalescer)
+
+      assert_raise ArgumentError, fn ->
+        ExPassword.Bcrypt.verify?("password", "$2y$04$")
+      end
+    end
+  end
+end
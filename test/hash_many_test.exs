@@ -0,0 +1,37 @@
+defmodule ExPassword.Bcrypt.HashManyTest do
+  use ExUnit.Case
+
+  describe "ExPassword.Bcrypt.hash_many/2" do
+    test "ensures a hash is produced for each password, in the same order" do
+      passwords = ["", "password", "\xFF\xFE", String.duplicate("a", 100)]
+      hashes = ExPassword.Bcrypt.hash_many(passwords, %{cost: 4})
+
+      assert length(passwords) == length(hashes)
+      Enum.each(hashes, fn hash -> assert <<"$2b$04$", _rest::binary-size(53)>> = hash end)
+      assert Enum.all?(Enum.zip(passwords, hashes), fn {password, hash} -> ExPassword.Bcrypt.verify?(password, hash) end)
+    end
+
+    test "generates a different salt for each password" do
+      hashes = ExPassword.Bcrypt.hash_many(List.duplicate("password", 300), %{cost: 4})
+
+      assert 300 == length(hashes)
+      assert 300 == hashes |> Enum.uniq() |> length()
+    end
+
+    test "accepts an empty list" do
+      assert [] == ExPassword.Bcrypt.hash_many([], %{cost: 4})
+    end
+
+    test "raises when options or passwords are invalid" do
+      assert_raise ArgumentError, fn ->
+        ExPassword.Bcrypt.hash_many([""], %{cost: 2})
+      end
+      assert_raise ArgumentError, fn ->
+        ExPassword.Bcrypt.hash_many([""], %{})
+      end
+      assert_raise ArgumentError, fn ->
+        ExPassword.Bcrypt.hash_many(["", :password], %{cost: 4})
+      end
+    end
+  end
+end
@@ -8,6 +8,13 @@ defmodule ExPassword.Bcrypt.HashTest do
       assert <<"$2b$10$", _rest::binary-size(53)>> = ExPassword.Bcrypt.hash("", %{cost: 10})
     end
 
+    test "generates a different salt for each hash" do
+      hashes = Enum.map(1..50, fn _ -> ExPassword.Bcrypt.hash("password", %{cost: 4}) end)
+
+      assert 50 == hashes |> Enum.uniq_by(&binary_part(&1, 0, 29)) |> length()
+      assert Enum.all?(hashes, &ExPassword.Bcrypt.verify?("password", &1))
+    end
+
     test "raises when options are invalid" do
       assert_raise ArgumentError, fn ->
         ExPassword.Bcrypt.hash("", %{cost: 2})
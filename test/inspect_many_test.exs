@@ -0,0 +1,42 @@
+defmodule ExPassword.Bcrypt.InspectManyTest do
+  use ExUnit.Case
+
+  @hash4 "$2y$04$5LEzpJFJbsVLiAPtunma.eWxP0D4CvNd5fw4cV9wT3cSCO.5oG4iO"
+  @hash5 "$2a$05$CCCCCCCCCCCCCCCCCCCCC.E5YPO9kmyuRGyh0XouQYb4YMJKvyOeW"
+  # valid but for the unused bits of the last character of the digest
+  @invalid "$2a$05$CCCCCCCCCCCCCCCCCCCCC.E5YPO9kmyuRGyh0XouQYb4YMJKvyOeX"
+
+  describe "ExPassword.Bcrypt.inspect_many/2" do
+    test "ensures each hash is inspected as by get_options/1 and needs_rehash?/2" do
+      hashes = Enum.map(1..10_000, &Enum.at([@hash4, @hash5, @invalid], rem(&1, 3)))
+      {costs, valid, needs_rehash} = ExPassword.Bcrypt.inspect_many(IO.iodata_to_binary(hashes), %{cost: 4})
+
+      assert byte_size(costs) == 10_000
+      assert bit_size(valid) == 10_000
+      assert bit_size(needs_rehash) == 10_000
+      for {{hash, cost}, {valid?, rehash?}} <- Enum.zip(Enum.zip(hashes, :binary.bin_to_list(costs)), Enum.zip(for(<<b::1 <- valid>>, do: b), for(<<b::1 <- needs_rehash>>, do: b))) do
+        case ExPassword.Bcrypt.parse_hash(hash) do
+          {:ok, _handle} ->
+            assert {:ok, %{cost: cost}} == ExPassword.Bcrypt.get_options(hash)
+            assert 1 == valid?
+            assert ExPassword.Bcrypt.needs_rehash?(hash, %{cost: 4}) == (1 == rehash?)
+          {:error, :invalid} ->
+            assert {0, 0, 0} == {cost, valid?, rehash?}
+        end
+      end
+    end
+
+    test "ensures an empty binary gives empty results" do
+      assert {"", "", ""} == ExPassword.Bcrypt.inspect_many("", %{cost: 10})
+    end
+
+    test "raises on a truncated hash or invalid options" do
+      assert_raise ArgumentError, fn ->
+        ExPassword.Bcrypt.inspect_many(@hash4 <> "$2y$", %{cost: 4})
+      end
+      assert_raise ArgumentError, fn ->
+        ExPassword.Bcrypt.inspect_many(@hash4, %{cost: 2})
+      end
+    end
+  end
+end
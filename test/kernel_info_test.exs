@@ -0,0 +1,20 @@
+defmodule ExPassword.Bcrypt.KernelInfoTest do
+  use ExUnit.Case
+
+  describe "ExPassword.Bcrypt.kernel_info/0" do
+    test "reports the fastest supported kernel" do
+      assert %{kernel: kernel, kernels: kernels} = ExPassword.Bcrypt.kernel_info()
+      supported = Enum.filter(kernels, &(&1.supported))
+
+      assert %{name: ^kernel, lanes: lanes, rate: rate} = Enum.find(supported, &(&1.name == kernel))
+      assert %{lanes: ^lanes} = ExPassword.Bcrypt.kernel_info()
+      assert Enum.all?(supported, &(&1.rate > 0.0 and &1.rate <= rate))
+      assert Enum.any?(kernels, &(&1.name == :x1 and &1.lanes == 1))
+    end
+
+    test "reports the active backend" do
+      assert %{backend: backend} = ExPassword.Bcrypt.kernel_info()
+      assert backend in [:builtin, :libxcrypt]
+    end
+  end
+end
@@ -0,0 +1,44 @@
+defmodule ExPassword.Bcrypt.MatchesAnyTest do
+  use ExUnit.Case
+
+  @history [
+    "$2y$04$35MAXYSjPyfzANk1PE4jpe6BFtSTc3m125J3MsT9LfMAmKsxH.DIu",
+    "$2y$10$3gnIByDAmymRzloXsEjBCO5XqO0eahvErvNAG7jXr0SA4jm7g6QIO",
+    "$2y$04$5LEzpJFJbsVLiAPtunma.eWxP0D4CvNd5fw4cV9wT3cSCO.5oG4iO",
+    "$2y$04$GQ8fkszdqnITr1NAbV373egWUmXr7pSPDCV7OaJ1r0ftWsM5ALnOW",
+  ]
+
+  describe "ExPassword.Bcrypt.matches_any?/2" do
+    test "returns the index of the first matching hash" do
+      assert 0 == ExPassword.Bcrypt.matches_any?("", @history)
+      assert 2 == ExPassword.Bcrypt.matches_any?("password", @history)
+      assert 0 == ExPassword.Bcrypt.matches_any?("password", Enum.drop(@history, 3))
+    end
+
+    test "returns nil when no hash matches" do
+      assert nil == ExPassword.Bcrypt.matches_any?("drowssap", @history)
+      assert nil == ExPassword.Bcrypt.matches_any?("password", [])
+    end
+
+    test "finds a match beyond the first batch" do
+      history = List.duplicate(hd(@history), 130) ++ [Enum.at(@history, 2)]
+
+      assert 130 == ExPassword.Bcrypt.matches_any?("password", history)
+    end
+
+    test "raises on invalid hashes" do
+      assert_raise ArgumentError, fn ->
+        ExPassword.Bcrypt.matches_any?("password", ["$2y$04$"])
+      end
+    end
+
+    test "raises on an invalid hash even after a match" do
+      assert_raise ArgumentError, fn ->
+        ExPassword.Bcrypt.matches_any?("", @history ++ ["$2y$04$"])
+      end
+      assert_raise ArgumentError, fn ->
+        ExPassword.Bcrypt.matches_any?("", @history ++ ["$2y$99$35MAXYSjPyfzANk1PE4jpe6BFtSTc3m125J3MsT9LfMAmKsxH.DIu"])
+      end
+    end
+  end
+end
@@ -0,0 +1,42 @@
+defmodule ExPassword.Bcrypt.ParseHashTest do
+  use ExUnit.Case
+
+  @hash "$2y$04$5LEzpJFJbsVLiAPtunma.eWxP0D4CvNd5fw4cV9wT3cSCO.5oG4iO"
+
+  describe "ExPassword.Bcrypt.parse_hash/1" do
+    test "ensures a parsed hash is verified as its hash" do
+      assert {:ok, handle} = ExPassword.Bcrypt.parse_hash(@hash)
+      assert is_reference(handle)
+      assert ExPassword.Bcrypt.verify?("password", handle)
+      refute ExPassword.Bcrypt.verify?("", handle)
+      refute ExPassword.Bcrypt.verify?("password\0", handle)
+
+      hash = ExPassword.Bcrypt.hash("U*U", %{cost: 5})
+      assert {:ok, handle} = ExPassword.Bcrypt.parse_hash(hash)
+      assert ExPassword.Bcrypt.verify?("U*U", handle)
+    end
+
+    test "ensures a parsed hash can be inspected" do
+      assert {:ok, handle} = ExPassword.Bcrypt.parse_hash(@hash)
+      assert {:ok, %{cost: 4}} == ExPassword.Bcrypt.get_options(handle)
+      refute ExPassword.Bcrypt.needs_rehash?(handle, %{cost: 4})
+      assert ExPassword.Bcrypt.needs_rehash?(handle, %{cost: 5})
+    end
+
+    test "ensures a parsed hash can be cached in ETS" do
+      table = :ets.new(__MODULE__, [:set])
+      {:ok, handle} = ExPassword.Bcrypt.parse_hash(@hash)
+      :ets.insert(table, {"user", handle})
+
+      assert [{"user", cached}] = :ets.lookup(table, "user")
+      assert ExPassword.Bcrypt.verify?("password", cached)
+    end
+
+    test "ensures error on an invalid bcrypt hash" do
+      assert {:error, :invalid} == ExPassword.Bcrypt.parse_hash("25169a6624cdeb2e5d97dd96d0977b2b")
+      assert {:error, :invalid} == ExPassword.Bcrypt.parse_hash("$2c$10$0Foz280fKzIYqnK36x33fOFpUcrKsRrHH1v4guaN8lbLZFkAwhkc6")
+      # non canonical encoding of the digest (unused bits of its last character set)
+      assert {:error, :invalid} == ExPassword.Bcrypt.parse_hash("$2y$04$5LEzpJFJbsVLiAPtunma.eWxP0D4CvNd5fw4cV9wT3cSCO.5oG4iP")
+    end
+  end
+end
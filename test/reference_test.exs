@@ -50,8 +50,8 @@ if Code.ensure_loaded?(ExPassword.Bcrypt.Base) do
         fn {hash, password} ->
           result = ExPassword.Bcrypt.Base.hash_nif(password, hash)
           assert hash == result
-          assert ExPassword.Bcrypt.Base.verify_nif(password, hash)
-          assert ExPassword.Bcrypt.Base.verify_nif(password, result)
+          assert ExPassword.Bcrypt.Base.verify(password, hash)
+          assert ExPassword.Bcrypt.Base.verify(password, result)
         end
       )
     end
@@ -0,0 +1,65 @@
+defmodule ExPassword.Bcrypt.SingleFlightTest do
+  use ExUnit.Case
+
+  @hash "$2y$10$26108htOOGxDvB0pR82L8eYluJgCNCCJr1opIwzM0Te3zJmp29Rmy"
+  @slow_hash "$2b$13$tqXDqiqqiD1XjFa/lOQ2/.mOueESdYsCzyQ3tmkFLIpFtLN1KBqCS"
+
+  defp await_in_flight do
+    if 0 == ExPassword.Bcrypt.single_flight().in_flight do
+      Process.sleep(1)
+      await_in_flight()
+    end
+  end
+
+  describe "ExPassword.Bcrypt.single_flight/0" do
+    test "counts each concurrent verification as computed or saved" do
+      %{computed: computed, saved: saved} = ExPassword.Bcrypt.single_flight()
+      results =
+        1..8
+        |> Enum.map(fn _ -> Task.async(fn -> ExPassword.Bcrypt.verify?("password", @hash) end) end)
+        |> Enum.map(&Task.await(&1, :infinity))
+
+      assert Enum.all?(results)
+      assert %{computed: computed_after, saved: saved_after, in_flight: 0} = ExPassword.Bcrypt.single_flight()
+      assert 8 == computed_after - computed + saved_after - saved
+    end
+
+    test "attaches the verifications arriving while an identical one is running to it" do
+      %{saved: saved} = ExPassword.Bcrypt.single_flight()
+      # a cost of 13 keeps the first verification running long after the other callers are released
+      tasks =
+        Enum.map(1..8, fn _ ->
+          Task.async(fn ->
+            receive do
+              :go ->
+                ExPassword.Bcrypt.verify?("password", @slow_hash)
+            end
+          end)
+        end)
+      Enum.each(tasks, &send(&1.pid, :go))
+      results = Enum.map(tasks, &Task.await(&1, :infinity))
+
+      assert List.duplicate(true, 8) == results
+      assert %{saved: saved_after, in_flight: 0} = ExPassword.Bcrypt.single_flight()
+      assert saved_after - saved > 0
+    end
+
+    test "parks the late callers instead of holding a dirty scheduler" do
+      task = Task.async(fn -> ExPassword.Bcrypt.verify?("password", @slow_hash) end)
+      await_in_flight()
+
+      assert {:wait, ref} = ExPassword.Bcrypt.Base.verify_nif("password", @slow_hash)
+      assert true == Task.await(task, :infinity)
+      assert_receive {:bcrypt_verified, ^ref, true}
+    end
+
+    test "does not share the result of a different password" do
+      tasks = [
+        Task.async(fn -> ExPassword.Bcrypt.verify?("password", @hash) end),
+        Task.async(fn -> ExPassword.Bcrypt.verify?("drowssap", @hash) end),
+      ]
+
+      assert [true, false] == Enum.map(tasks, &Task.await(&1, :infinity))
+    end
+  end
+end
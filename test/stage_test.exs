@@ -0,0 +1,49 @@
+defmodule ExPassword.Bcrypt.StageTest do
+  use ExUnit.Case
+
+  alias ExPassword.Bcrypt.Stage
+
+  @hash "$2y$04$5LEzpJFJbsVLiAPtunma.eWxP0D4CvNd5fw4cV9wT3cSCO.5oG4iO"
+
+  defp run(events, options) do
+    {:ok, producer} = GenStage.from_enumerable(events)
+    {:ok, stage} = Stage.start_link([subscribe_to: [producer]] ++ options)
+
+    [{stage, cancel: :transient}]
+    |> GenStage.stream()
+    |> Enum.to_list()
+  end
+
+  describe "ExPassword.Bcrypt.Stage" do
+    test "hashes {id, password} events by batches, in order" do
+      events = Enum.map(1..20, &{&1, "password#{&1}"})
+      results = run(events, mode: :hash, options: %{cost: 4}, batch_size: 8)
+
+      assert Enum.map(events, &elem(&1, 0)) == Enum.map(results, &elem(&1, 0))
+      for {{id, password}, {id, hash}} <- Enum.zip(events, results) do
+        assert {:ok, %{cost: 4}} == ExPassword.Bcrypt.get_options(hash)
+        assert ExPassword.Bcrypt.verify?(password, hash)
+      end
+    end
+
+    test "verifies {id, password, hash} events" do
+      events = [{:a, "password", @hash}, {:b, "", @hash}, {:c, "password", "$2y$04$"}, {:d, "password", @hash}]
+
+      assert [{:a, true}, {:b, false}, {:c, :error}, {:d, true}] == run(events, mode: :verify)
+    end
+
+    test "reports its statistics" do
+      {:ok, producer} = GenStage.from_enumerable(Enum.map(1..6, &{&1, "password"}))
+      {:ok, stage} = Stage.start_link(mode: :hash, options: %{cost: 4}, batch_size: 4, subscribe_to: [{producer, cancel: :temporary}])
+
+      assert 6 == [stage] |> GenStage.stream() |> Enum.take(6) |> length()
+      assert %{batches: 2, events: 6, batch_size: 4, fill_ratio: 0.75, rate: rate} = Stage.stats(stage)
+      assert rate > 0.0
+    end
+
+    test "defaults the size of the batches to the lanes of the selected kernel" do
+      assert %{lanes: lanes} = ExPassword.Bcrypt.kernel_info()
+      assert lanes == Stage.batch_size()
+    end
+  end
+end
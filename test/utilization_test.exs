@@ -0,0 +1,23 @@
+defmodule ExPassword.Bcrypt.UtilizationTest do
+  use ExUnit.Case
+
+  describe "ExPassword.Bcrypt.utilization/0" do
+    test "reports the busy ratio of each lane of the selected kernel" do
+      %{kernel: kernel, kernels: kernels} = ExPassword.Bcrypt.kernel_info()
+      %{lanes: lanes} = Enum.find(kernels, &(&1.name == kernel))
+      pairs =
+        [
+          {"password", "$2y$04$5LEzpJFJbsVLiAPtunma.eWxP0D4CvNd5fw4cV9wT3cSCO.5oG4iO"},
+          {"U*U", "$2a$05$CCCCCCCCCCCCCCCCCCCCC.E5YPO9kmyuRGyh0XouQYb4YMJKvyOeW"},
+        ]
+        |> List.duplicate(lanes)
+        |> List.flatten()
+
+      assert Enum.all?(ExPassword.Bcrypt.verify_many?(pairs))
+      assert %{kernel: ^kernel, lanes: ^lanes, iterations: iterations, busy: busy} = ExPassword.Bcrypt.utilization()
+      assert iterations > 0
+      assert lanes == length(busy)
+      assert Enum.all?(busy, &(&1 >= 0.0 and &1 <= 1.0))
+    end
+  end
+end
@@ -0,0 +1,38 @@
+defmodule ExPassword.Bcrypt.VerifyAndUpgradeAsyncTest do
+  use ExUnit.Case
+
+  @hash "$2y$04$5LEzpJFJbsVLiAPtunma.eWxP0D4CvNd5fw4cV9wT3cSCO.5oG4iO"
+
+  describe "ExPassword.Bcrypt.verify_and_upgrade_async/3" do
+    test "returns {:ok, nil} when the hash is up to date" do
+      assert {:ok, nil} == ExPassword.Bcrypt.verify_and_upgrade_async("password", @hash, %{cost: 4})
+    end
+
+    test "sends the rehashed password when the cost differs" do
+      assert {:ok, ref} = ExPassword.Bcrypt.verify_and_upgrade_async("password", @hash, %{cost: 5})
+      assert is_reference(ref)
+      assert_receive {:bcrypt_rehashed, ^ref, new_hash}, 5_000
+      assert <<"$2b$05$", _rest::binary-size(53)>> = new_hash
+      assert ExPassword.Bcrypt.verify?("password", new_hash)
+    end
+
+    test "returns {:ok, :deferred} when too many rehashes are pending" do
+      # each rehash at cost 10 takes much longer than a verification at cost 4
+      results = Enum.map(1..64, fn _ -> ExPassword.Bcrypt.verify_and_upgrade_async("password", @hash, %{cost: 10}) end)
+
+      assert {:ok, :deferred} in results
+      assert Enum.all?(results, &match?({:ok, ref_or_deferred} when is_reference(ref_or_deferred) or :deferred == ref_or_deferred, &1))
+    end
+
+    test "returns :error when the password does not match" do
+      assert :error == ExPassword.Bcrypt.verify_and_upgrade_async("", @hash, %{cost: 5})
+      refute_receive {:bcrypt_rehashed, _ref, _new_hash}, 100
+    end
+
+    test "raises when options are invalid" do
+      assert_raise ArgumentError, fn ->
+        ExPassword.Bcrypt.verify_and_upgrade_async("password", @hash, %{cost: 32})
+      end
+    end
+  end
+end
@@ -0,0 +1,32 @@
+defmodule ExPassword.Bcrypt.VerifyAndUpgradeTest do
+  use ExUnit.Case
+
+  @hash "$2y$04$5LEzpJFJbsVLiAPtunma.eWxP0D4CvNd5fw4cV9wT3cSCO.5oG4iO"
+
+  describe "ExPassword.Bcrypt.verify_and_upgrade/3" do
+    test "returns {:ok, nil} when the hash is up to date" do
+      assert {:ok, nil} == ExPassword.Bcrypt.verify_and_upgrade("password", @hash, %{cost: 4})
+    end
+
+    test "returns the rehashed password when the cost differs" do
+      assert {:ok, new_hash} = ExPassword.Bcrypt.verify_and_upgrade("password", @hash, %{cost: 5})
+      assert <<"$2b$05$", _rest::binary-size(53)>> = new_hash
+      assert ExPassword.Bcrypt.verify?("password", new_hash)
+      refute ExPassword.Bcrypt.needs_rehash?(new_hash, %{cost: 5})
+    end
+
+    test "returns :error when the password does not match" do
+      assert :error == ExPassword.Bcrypt.verify_and_upgrade("", @hash, %{cost: 4})
+      assert :error == ExPassword.Bcrypt.verify_and_upgrade("", @hash, %{cost: 5})
+    end
+
+    test "raises when options or the hash are invalid" do
+      assert_raise ArgumentError, fn ->
+        ExPassword.Bcrypt.verify_and_upgrade("password", @hash, %{cost: 3})
+      end
+      assert_raise ArgumentError, fn ->
+        ExPassword.Bcrypt.verify_and_upgrade("password", "$2y$04$", %{cost: 4})
+      end
+    end
+  end
+end
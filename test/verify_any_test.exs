@@ -0,0 +1,31 @@
+defmodule ExPassword.Bcrypt.VerifyAnyTest do
+  use ExUnit.Case
+
+  @hash "$2y$04$5LEzpJFJbsVLiAPtunma.eWxP0D4CvNd5fw4cV9wT3cSCO.5oG4iO"
+
+  describe "ExPassword.Bcrypt.verify_any?/2" do
+    test "returns true if one of the candidates matches" do
+      assert true == ExPassword.Bcrypt.verify_any?(["PASSWORD", "password ", "password"], @hash)
+      assert true == ExPassword.Bcrypt.verify_any?(["password"], @hash)
+      assert true == ExPassword.Bcrypt.verify_any?(["", "", "password"], "$2y$10$26108htOOGxDvB0pR82L8eYluJgCNCCJr1opIwzM0Te3zJmp29Rmy")
+    end
+
+    test "returns false if none of the candidates matches" do
+      assert false == ExPassword.Bcrypt.verify_any?(["PASSWORD", "password ", "Password"], @hash)
+      assert false == ExPassword.Bcrypt.verify_any?([], @hash)
+    end
+
+    test "handles more candidates than the NIF processes at once" do
+      assert true == ExPassword.Bcrypt.verify_any?(List.duplicate("", 150) ++ ["password"], @hash)
+    end
+
+    test "raises on invalid hashes or candidates" do
+      assert_raise ArgumentError, fn ->
+        ExPassword.Bcrypt.verify_any?(["password"], "$2y$04$")
+      end
+      assert_raise ArgumentError, fn ->
+        ExPassword.Bcrypt.verify_any?([:password], @hash)
+      end
+    end
+  end
+end
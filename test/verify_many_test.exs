@@ -0,0 +1,50 @@
+defmodule ExPassword.Bcrypt.VerifyManyTest do
+  use ExUnit.Case
+
+  @pairs [
+    {"", "$2y$04$35MAXYSjPyfzANk1PE4jpe6BFtSTc3m125J3MsT9LfMAmKsxH.DIu"},
+    {"", "$2y$10$3gnIByDAmymRzloXsEjBCO5XqO0eahvErvNAG7jXr0SA4jm7g6QIO"},
+    {"password", "$2y$04$5LEzpJFJbsVLiAPtunma.eWxP0D4CvNd5fw4cV9wT3cSCO.5oG4iO"},
+    {"password", "$2y$10$26108htOOGxDvB0pR82L8eYluJgCNCCJr1opIwzM0Te3zJmp29Rmy"},
+    {"", "$2y$04$5LEzpJFJbsVLiAPtunma.eWxP0D4CvNd5fw4cV9wT3cSCO.5oG4iO"},
+    {"", "$2y$10$26108htOOGxDvB0pR82L8eYluJgCNCCJr1opIwzM0Te3zJmp29Rmy"},
+    {"password\x00", "$2y$04$GQ8fkszdqnITr1NAbV373egWUmXr7pSPDCV7OaJ1r0ftWsM5ALnOW"},
+    {"password", "$2y$04$GQ8fkszdqnITr1NAbV373egWUmXr7pSPDCV7OaJ1r0ftWsM5ALnOW"},
+  ]
+
+  describe "ExPassword.Bcrypt.verify_many?/1" do
+    test "gives the same results as verify?/2, in the same order" do
+      assert [true, true, true, true, false, false, false, true] == ExPassword.Bcrypt.verify_many?(@pairs)
+      assert Enum.map(@pairs, fn {password, hash} -> ExPassword.Bcrypt.verify?(password, hash) end) == ExPassword.Bcrypt.verify_many?(@pairs)
+    end
+
+    test "handles more pairs than the NIF processes at once" do
+      pairs =
+        @pairs
+        |> Enum.filter(fn {_password, hash} -> String.starts_with?(hash, "$2y$04$") end)
+        |> List.duplicate(60)
+        |> List.flatten()
+
+      assert Enum.map(pairs, fn {password, hash} -> ExPassword.Bcrypt.verify?(password, hash) end) == ExPassword.Bcrypt.verify_many?(pairs)
+    end
+
+    test "accepts an empty list" do
+      assert [] == ExPassword.Bcrypt.verify_many?([])
+    end
+
+    test "raises on invalid pairs" do
+      assert_raise ArgumentError, fn ->
+        ExPassword.Bcrypt.verify_many?([{"password"}])
+      end
+      assert_raise ArgumentError, fn ->
+        ExPassword.Bcrypt.verify_many?([{"password", "$2y$04$"}])
+      end
+    end
+
+    test "raises on a hash which does not parse, wherever it is in the list" do
+      assert_raise ArgumentError, fn ->
+        ExPassword.Bcrypt.verify_many?(@pairs ++ [{"password", "$2y$99$5LEzpJFJbsVLiAPtunma.eWxP0D4CvNd5fw4cV9wT3cSCO.5oG4iO"}])
+      end
+    end
+  end
+end